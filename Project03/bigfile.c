@@ -0,0 +1,71 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+#include "dstat.h"
+
+// Large file test: write a file that reaches into the double
+// indirect blocks, read it back, then remove it.
+
+#define EXTRA 16   // blocks past the single indirect ones
+
+char buf[MAXBSIZE];
+
+void failed()
+{
+  printf(1, "Test failed!\n");
+  unlink("bigfile.tmp");
+  exit();
+}
+
+int main(int argc, char *argv[])
+{
+  struct dstat st;
+  int fd, i, nblock, start;
+
+  if (dstat(&st) < 0)
+    failed();
+  nblock = NDIRECT + NINDIRECT(st.bsize) + EXTRA;
+  printf(1, "Big file test: %d blocks of %d bytes\n", nblock, st.bsize);
+
+  start = uptime();
+  if ((fd = open("bigfile.tmp", O_CREATE | O_RDWR)) < 0)
+    failed();
+  for (i = 0; i < nblock; i++) {
+    memset(buf, i, st.bsize);
+    ((int *)buf)[0] = i;
+    if (write(fd, buf, st.bsize) != st.bsize) {
+      printf(1, "Write of block %d failed\n", i);
+      failed();
+    }
+  }
+  close(fd);
+  printf(1, "wrote %d KB in %d ticks\n", nblock * (st.bsize / 1024),
+         uptime() - start);
+
+  start = uptime();
+  if ((fd = open("bigfile.tmp", O_RDONLY)) < 0)
+    failed();
+  for (i = 0; i < nblock; i++) {
+    if (read(fd, buf, st.bsize) != st.bsize) {
+      printf(1, "Read of block %d failed\n", i);
+      failed();
+    }
+    if (((int *)buf)[0] != i || (uchar)buf[st.bsize - 1] != (uchar)i) {
+      printf(1, "Block %d has the wrong contents\n", i);
+      failed();
+    }
+  }
+  if (read(fd, buf, st.bsize) != 0)
+    failed();
+  close(fd);
+  printf(1, "read back in %d ticks\n", uptime() - start);
+
+  start = uptime();
+  if (unlink("bigfile.tmp") < 0)
+    failed();
+  printf(1, "removed in %d ticks\n", uptime() - start);
+  printf(1, "All tests passed!\n");
+  exit();
+}
@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -17,41 +17,270 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Buffers are hashed by (dev, blockno) into NBUCKET chains, each
+// with its own lock, so lookups of different blocks do not contend.
+// A bucket lock protects its chain and the refcnt and identity of
+// the buffers on it. Recycling a buffer moves it between buckets
+// and is serialized by bcache.lock, which is always taken before
+// any bucket lock. Unreferenced buffers sit on an idle list in
+// order of release, under bcache.idlelock, which is taken after
+// a bucket lock; a miss recycles the least recently released.
+//
+// Buffer data lives in kalloc pages, BPP buffers to a page. At
+// boot the cache takes 1/BCACHEFRAC of free memory. When kalloc
+// runs dry, breclaim() gives back idle pages from the end of the
+// cache; later misses grow it again while memory is plentiful.
+//
+// Blocks are bsize bytes: MINBSIZE until iinit() reads the super
+// block and calls bsetsize() with the file system's block size.
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "bstat.h"
 
-struct {
+#define NBUCKET 1021
+#define BPP     (PGSIZE/bsize)  // buffers sharing one data page
+#define LOWMEM  256             // free pages below which the cache won't grow
+#define NODEV   ((uint)-1)      // dev of a buffer on no hash chain
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;
+  uint hits;
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct spinlock lock;  // serializes eviction, growth and shrinking
+  struct buf buf[NBUFMAX];
+  int nbuf;              // buf[0..nbuf) have data pages
+  int maxbuf;            // size chosen at boot
+  uint misses;
+
+  // Idle buffers, most recently released at idle.next.
+  struct spinlock idlelock;
+  struct buf idle;
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+uint bsize = MINBSIZE;
+
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev*31 + blockno) % NBUCKET];
+}
+
+// Put b on the idle list, at the most recently used end,
+// or at the other end to be recycled first.
+// Must hold bcache.idlelock.
+static void
+idleput(struct buf *b, int first)
+{
+  struct buf *h;
+
+  h = first ? bcache.idle.prev : &bcache.idle;
+  b->next = h->next;
+  b->prev = h;
+  h->next->prev = b;
+  h->next = b;
+}
+
+// Take b off the idle list. Must hold bcache.idlelock.
+static void
+idledel(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+  b->next = b->prev = 0;
+}
+
+// Add one page worth of buffers to the cache.
+// Must hold bcache.lock, or be single-threaded at boot.
+static int
+bgrow(void)
+{
+  struct buf *b;
+  char *page;
+  int i;
+
+  if(bcache.nbuf + BPP > bcache.maxbuf || (page = kalloctry()) == 0)
+    return 0;
+  for(i = 0; i < BPP; i++){
+    b = &bcache.buf[bcache.nbuf + i];
+    b->data = (uchar*)page + i*bsize;
+    b->dev = NODEV;
+    b->flags = 0;
+    b->refcnt = 0;
+    acquire(&bcache.idlelock);
+    idleput(b, 1);
+    release(&bcache.idlelock);
+  }
+  bcache.nbuf += BPP;
+  return 1;
+}
+
+// Size the cache for the current block size and fill it.
+// Must hold bcache.lock, or be single-threaded at boot.
+static void
+bfill(void)
+{
+  int n;
+
+  n = kfreecount() / BCACHEFRAC * BPP;
+  if(n < NBUF)
+    n = NBUF;
+  if(n > NBUFMAX)
+    n = NBUFMAX;
+  bcache.maxbuf = n - n % BPP;
+  while(bgrow())
+    ;
+  if(bcache.nbuf < NBUF)
+    panic("bfill: out of memory");
+}
+
+// Must be called after kinit2(), once all memory is free.
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
+  initlock(&bcache.idlelock, "bcache.idle");
+  bcache.idle.prev = bcache.idle.next = &bcache.idle;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    initlock(&bk->lock, "bcache.bucket");
+  for(b = bcache.buf; b < bcache.buf+NBUFMAX; b++)
+    initsleeplock(&b->lock, "buffer");
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  bfill();
+}
+
+// Find a cached block in its bucket and take a reference.
+// Caller must hold bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b; b = b->hnext){
+    if(b->dev == dev && b->blockno == blockno){
+      if(b->refcnt++ == 0){
+        acquire(&bcache.idlelock);
+        if(b->next)
+          idledel(b);
+        release(&bcache.idlelock);
+      }
+      bk->hits++;
+      return b;
+    }
+  }
+  return 0;
+}
+
+// Drop a reference to b, putting it on the idle list if it
+// was the last one.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  if(--b->refcnt == 0){
+    acquire(&bcache.idlelock);
+    idleput(b, 0);
+    release(&bcache.idlelock);
   }
+  release(&bk->lock);
+}
+
+// Take b off its hash chain. Must hold bcache.lock and b's bucket lock.
+static void
+bunhash(struct bucket *bk, struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp = &bk->head; *pp != b; pp = &(*pp)->hnext)
+    ;
+  *pp = b->hnext;
+  b->dev = NODEV;
+}
+
+// Recycle an unused buffer for a block that is not cached,
+// and hash it in bk with one reference. Its sleep-lock is
+// free. Must hold bcache.lock and bk->lock.
+static struct buf*
+brecycle(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+  struct bucket *vbk;
+  int n, ok;
+
+  bcache.misses++;
+
+  // Grow back toward the boot size if memory allows; the new
+  // buffers go to the front of the idle list.
+  if(bcache.nbuf < bcache.maxbuf && kfreecount() > LOWMEM)
+    bgrow();
+
+  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
+  // because log.c has modified it but not yet committed it;
+  // such buffers move to the other end of the idle list, so
+  // they are passed over once per commit, not once per miss.
+  // A buffer's identity only changes under bcache.lock, so the
+  // victim's bucket is known, but that lock must be taken
+  // before idlelock; a lookup may take the victim in between,
+  // so it is checked again with both held.
+  for(n = 0;; n++){
+    if(n >= bcache.nbuf)
+      panic("bget: no buffers");
+    acquire(&bcache.idlelock);
+    if((b = bcache.idle.prev) == &bcache.idle){
+      release(&bcache.idlelock);
+      panic("bget: no buffers");
+    }
+    if(b->dev == NODEV){
+      idledel(b);
+      release(&bcache.idlelock);
+      break;
+    }
+    release(&bcache.idlelock);
+    vbk = bhash(b->dev, b->blockno);
+    if(vbk != bk)
+      acquire(&vbk->lock);
+    acquire(&bcache.idlelock);
+    ok = 0;
+    if(b->refcnt == 0 && b->next != 0){
+      idledel(b);
+      if(b->flags & B_DIRTY)
+        idleput(b, 0);
+      else
+        ok = 1;
+    }
+    release(&bcache.idlelock);
+    if(ok)
+      bunhash(vbk, b);
+    if(vbk != bk)
+      release(&vbk->lock);
+    if(ok)
+      break;
+  }
+
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  b->refcnt = 1;
+  b->hnext = bk->head;
+  bk->head = b;
+  return b;
 }
 
 // Look through buffer cache for block on device dev.
@@ -61,34 +290,127 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  struct bucket *bk;
 
-  acquire(&bcache.lock);
+  bk = bhash(dev, blockno);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b){
+    acquiresleep(&b->lock);
+    return b;
   }
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Not cached; recycle an unused buffer. Look again once
+  // eviction is serialized, in case another CPU just cached it.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) == 0)
+    b = brecycle(bk, dev, blockno);
+  release(&bk->lock);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Give up to n idle data pages back to the page allocator,
+// taken from the end of the cache, never going below NBUF.
+// Called by kalloc() when it runs out of memory.
+// Returns the number of pages freed.
+int
+breclaim(int n)
+{
+  struct buf *b, *group;
+  struct bucket *bk;
+  int freed;
+  char *page;
+
+  if(bcache.maxbuf == 0)
+    return 0;  // not initialized yet
+
+  freed = 0;
+  acquire(&bcache.lock);
+  while(freed < n && bcache.nbuf - BPP >= NBUF){
+    group = &bcache.buf[bcache.nbuf - BPP];
+    for(b = group; b < group + BPP; b++){
+      if(b->dev == NODEV)
+        continue;
+      bk = bhash(b->dev, b->blockno);
+      acquire(&bk->lock);
+      if(b->refcnt != 0 || (b->flags & B_DIRTY) != 0){
+        release(&bk->lock);
+        break;
+      }
+      bunhash(bk, b);
+      release(&bk->lock);
+    }
+    if(b < group + BPP)
+      break;  // busy; the buffers unhashed so far stay usable
+
+    page = (char*)group->data;
+    acquire(&bcache.idlelock);
+    for(b = group; b < group + BPP; b++){
+      if(b->next)
+        idledel(b);
+      b->data = 0;
     }
+    release(&bcache.idlelock);
+    bcache.nbuf -= BPP;
+    kfree(page);
+    freed++;
   }
-  panic("bget: no buffers");
+  release(&bcache.lock);
+  return freed;
+}
+
+// Switch to blocks of n bytes. Every cached block is dropped
+// and the data pages carved again, so this is only for use
+// before the file system is in use.
+void
+bsetsize(uint n)
+{
+  struct buf *b;
+  struct bucket *bk;
+
+  if(n < MINBSIZE || n > MAXBSIZE || PGSIZE % n != 0)
+    panic("bsetsize: bad block size");
+  if(n == bsize)
+    return;
+
+  acquire(&bcache.lock);
+  for(b = bcache.buf; b < bcache.buf + bcache.nbuf; b++)
+    if(b->refcnt != 0 || (b->flags & B_DIRTY) != 0)
+      panic("bsetsize: busy");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    bk->head = 0;
+  for(b = bcache.buf; b < bcache.buf + bcache.nbuf; b += BPP)
+    kfree((char*)b->data);
+  for(b = bcache.buf; b < bcache.buf + bcache.nbuf; b++)
+    b->data = 0;
+  bcache.nbuf = 0;
+  bcache.idle.prev = bcache.idle.next = &bcache.idle;
+
+  bsize = n;
+  bfill();
+  release(&bcache.lock);
+}
+
+// Report cache size and hit rate.
+void
+bcachestat(struct bstat *st)
+{
+  struct bucket *bk;
+
+  acquire(&bcache.lock);
+  st->nbuf = bcache.nbuf;
+  st->maxbuf = bcache.maxbuf;
+  st->misses = bcache.misses;
+  st->hits = 0;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    st->hits += bk->hits;
+  release(&bcache.lock);
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -104,6 +426,87 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buffer for a block that is not in the cache,
+// marked for an asynchronous read, or 0 if the block is already
+// cached or on its way. Never sleeps: readahead may hold other
+// locked buffers that it has not handed to the disk yet.
+static struct buf*
+bgetasync(uint dev, uint blockno)
+{
+  struct buf *b;
+  struct bucket *bk;
+
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
+  for(b = bk->head; b; b = b->hnext)
+    if(b->dev == dev && b->blockno == blockno)
+      break;
+  release(&bk->lock);
+  if(b)
+    return 0;
+
+  // Look again once eviction is serialized, and lock the new
+  // buffer before a lookup can find it.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  for(b = bk->head; b; b = b->hnext)
+    if(b->dev == dev && b->blockno == blockno)
+      break;
+  if(b == 0){
+    b = brecycle(bk, dev, blockno);
+    if(!tryacquiresleep(&b->lock))
+      panic("bgetasync");
+    b->flags |= B_ASYNC;
+  } else {
+    b = 0;
+  }
+  release(&bk->lock);
+  release(&bcache.lock);
+  return b;
+}
+
+// Start reading a block into the cache without waiting for it.
+// Does nothing if the block is already cached or on its way.
+// The disk interrupt unlocks and releases the buffer when the
+// read completes (see basyncdone).
+void
+bread_async(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bgetasync(dev, blockno)) != 0)
+    iderw(b);
+}
+
+// Start reading the n blocks from blockno on, as bread_async()
+// does, handing each run of uncached blocks to the disk driver
+// at once so that it can read them in one request.
+void
+breadv_async(uint dev, uint blockno, int n)
+{
+  struct buf *bp[READAHEAD], *b;
+  int nb;
+
+  nb = 0;
+  for(; n > 0; n--, blockno++){
+    if((b = bgetasync(dev, blockno)) != 0)
+      bp[nb++] = b;
+    if(nb > 0 && (b == 0 || nb == READAHEAD || n == 1)){
+      iderwv(bp, nb);
+      nb = 0;
+    }
+  }
+}
+
+// Finish an asynchronous read on behalf of the process that
+// started it. Called by the disk driver, in interrupt context.
+void
+basyncdone(struct buf *b)
+{
+  releasesleep(&b->lock);
+  bput(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -114,8 +517,23 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Write n locked buffers together, so that neighbouring
+// blocks share disk requests.
+void
+bwritev(struct buf **bp, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bp[i]->lock))
+      panic("bwritev");
+    bp[i]->flags |= B_DIRTY;
+  }
+  iderwv(bp, n);
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Move to the most recently used end of the idle list.
 void
 brelse(struct buf *b)
 {
@@ -123,21 +541,7 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
-
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-
-  release(&bcache.lock);
+  bput(b);
 }
 //PAGEBREAK!
 // Blank page.
-
@@ -0,0 +1,23 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "bstat.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct bstat st;
+  uint total;
+
+  if(bstat(&st) < 0){
+    printf(2, "bstat: failed\n");
+    exit();
+  }
+  total = st.hits + st.misses;
+  printf(1, "buffers %d/%d hits %d misses %d", st.nbuf, st.maxbuf,
+         st.hits, st.misses);
+  if(total > 0)
+    printf(1, " hit rate %d%%", st.hits * 100 / total);
+  printf(1, "\n");
+  exit();
+}
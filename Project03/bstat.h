@@ -0,0 +1,7 @@
+// Buffer cache statistics, returned by the bstat system call.
+struct bstat {
+  uint nbuf;    // Buffers currently in the cache
+  uint maxbuf;  // Size chosen at boot
+  uint hits;    // Lookups found in the cache
+  uint misses;  // Lookups that had to recycle a buffer
+};
@@ -4,11 +4,15 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  struct buf *prev; // idle list, while refcnt is 0
   struct buf *next;
+  struct buf *hnext; // hash bucket chain
   struct buf *qnext; // disk queue
-  uchar data[BSIZE];
+  struct buf *mnext; // rest of a multi-block disk request
+  uint qtime;   // ticks when queued for the disk
+  uchar *data;  // bsize bytes within a kalloc page
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // read in flight; the disk interrupt releases it
 
@@ -0,0 +1,74 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Cache locality benchmark for setaffinity().
+// Forks more memory-bound workers than there are CPUs, so the
+// scheduler keeps moving them around, then repeats the run with
+// each worker pinned to one CPU.
+// Usage: cachebench [ncpu]
+
+#define NWORKER 4
+#define BUFSZ (64*1024)
+#define NPASS 400
+
+void worker(void)
+{
+  int i, pass;
+  uint sum;
+  uint *buf;
+
+  if ((buf = (uint *)malloc(BUFSZ)) == 0) {
+    printf(1, "cachebench: out of memory\n");
+    exit();
+  }
+  for (i = 0; i < BUFSZ / 4; i++)
+    buf[i] = i;
+
+  sum = 0;
+  for (pass = 0; pass < NPASS; pass++)
+    for (i = 0; i < BUFSZ / 4; i += 16)
+      sum += buf[i]++;
+  if (sum == 0)
+    printf(1, "cachebench: impossible sum\n");
+  exit();
+}
+
+int run(int ncpu, int pin)
+{
+  int i, pid, start;
+
+  start = uptime();
+  for (i = 0; i < NWORKER; i++) {
+    pid = fork();
+    if (pid < 0) {
+      printf(1, "cachebench: fork failed\n");
+      exit();
+    }
+    if (pid == 0) {
+      if (pin && setaffinity(0, 1 << (i % ncpu)) < 0) {
+        printf(1, "cachebench: setaffinity failed\n");
+        exit();
+      }
+      worker();
+    }
+  }
+  for (i = 0; i < NWORKER; i++)
+    wait();
+  return uptime() - start;
+}
+
+int main(int argc, char *argv[])
+{
+  int ncpu;
+
+  ncpu = argc > 1 ? atoi(argv[1]) : 2;
+  if (ncpu < 1)
+    ncpu = 1;
+
+  printf(1, "cachebench: %d workers, %d KB each, %d cpus\n",
+         NWORKER, BUFSZ / 1024, ncpu);
+  printf(1, "floating: %d ticks\n", run(ncpu, 0));
+  printf(1, "pinned:   %d ticks\n", run(ncpu, 1));
+  exit();
+}
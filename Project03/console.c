@@ -10,6 +10,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "file.h"
+#include "poll.h"
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
@@ -221,6 +222,7 @@ consoleintr(int (*getc)(void))
         if(c == '\n' || c == C('D') || input.e == input.r+INPUT_BUF){
           input.w = input.e;
           wakeup(&input.r);
+          pollwakeup();
         }
       }
       break;
@@ -270,6 +272,21 @@ consoleread(struct inode *ip, char *dst, int n)
   return target - n;
 }
 
+// Which of events would not block: writes never do, and
+// reads don't once a line is in.
+int
+consolepoll(struct inode *ip, int events)
+{
+  int r;
+
+  acquire(&cons.lock);
+  r = POLLOUT;
+  if(input.r != input.w)
+    r |= POLLIN;
+  release(&cons.lock);
+  return r & events;
+}
+
 int
 consolewrite(struct inode *ip, char *buf, int n)
 {
@@ -292,6 +309,7 @@ consoleinit(void)
 
   devsw[CONSOLE].write = consolewrite;
   devsw[CONSOLE].read = consoleread;
+  devsw[CONSOLE].poll = consolepoll;
   cons.locking = 1;
 
   ioapicenable(IRQ_KBD, 0);
@@ -1,6 +1,9 @@
+struct bstat;
+struct dstat;
 struct buf;
 struct context;
 struct file;
+struct iovec;
 struct inode;
 struct pipe;
 struct proc;
@@ -12,9 +15,17 @@ struct superblock;
 
 // bio.c
 void            binit(void);
+void            bsetsize(uint);
+extern uint     bsize;
 struct buf*     bread(uint, uint);
+void            bread_async(uint, uint);
+void            breadv_async(uint, uint, int);
+void            basyncdone(struct buf*);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
+int             breclaim(int);
+void            bcachestat(struct bstat*);
 
 // console.c
 void            consoleinit(void);
@@ -31,12 +42,23 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, char*, int n);
+int             filereadv(struct file*, struct iovec*, int, int);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filewritev(struct file*, struct iovec*, int, int);
+int             filesend(struct file*, struct file*, int, int);
+int             filepoll(struct file*, int);
+uint            pollbegin(int);
+uint            pollsleep(uint);
+void            pollend(int);
+void            pollwakeup(void);
+void            polltick(void);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
+void            bmapinit(int);
 int             dirlink(struct inode*, char*, uint);
+void            dcforget(struct inode*, char*);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
@@ -50,6 +72,7 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+int             readifn(struct inode*, uint, uint, int (*)(void*, char*, int), void*);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
@@ -57,14 +80,19 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            iderwv(struct buf**, int);
+void            idestats(struct dstat*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
 extern uchar    ioapicid;
 void            ioapicinit(void);
+void            ioapicroute(int irq, int vec, int cpu);
 
 // kalloc.c
 char*           kalloc(void);
+char*           kalloctry(void);
+int             kfreecount(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
@@ -85,7 +113,19 @@ void            microdelay(int);
 void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
+void            begin_opn(int);
 void            end_op();
+void            log_sync(void);
+
+// mm.c
+void            mminit(void);
+struct mm*      mmalloc(pde_t*, uint);
+struct mm*      mmdup(struct mm*);
+void            mmput(struct mm*);
+int             mmgrow(struct mm*, int);
+uint            mmstackalloc(struct mm*);
+void            mmstackfree(struct mm*, uint);
+void            mmcopystacks(struct mm*, struct mm*, uint);
 
 // mp.c
 extern int      ismp;
@@ -95,11 +135,22 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// pci.c
+uint            pcifind(int, uint, uint);
+void            pcienable(uint);
+uint            pciread(uint, int);
+void            pciwrite(uint, int, uint);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
+int             pipeput(struct pipe*, char*, int);
+int             pipewait(struct pipe*);
+int             pipegetsize(struct pipe*);
+int             pipesetsize(struct pipe*, int);
+int             pipepoll(struct pipe*, int, int);
 
 //PAGEBREAK: 16
 // proc.c
@@ -107,6 +158,7 @@ int             cpuid(void);
 void            exit(void);
 int             fork(void);
 int             growproc(int);
+int             kthread(char*, void (*)(void));
 int             kill(int);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
@@ -135,6 +187,7 @@ void            popcli(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+int             tryacquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
@@ -190,6 +243,11 @@ void            clearpteu(pde_t *pgdir, char *uva);
 int thread_create(thread_t *thread, void *(* start_routine)(void *), void *arg);
 void thread_exit(void *retval);
 int thread_join(thread_t thread, void **retval);
+void thread_free(struct proc *p);
+void thread_promote(struct proc *p);
+int yieldto(thread_t tid);
+int setaffinity(int id, uint mask);
+int getaffinity(int id);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
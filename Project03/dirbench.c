@@ -0,0 +1,79 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+// Directory benchmark: create, open and remove n files in one
+// directory. Build fs.img with FSFLAGS=-d for hashed directories,
+// and with enough inodes (NINODES) for large n.
+// Usage: dirbench [n]
+
+void failed()
+{
+  printf(1, "Test failed!\n");
+  exit();
+}
+
+void fname(char *buf, int i)
+{
+  char tmp[10];
+  int n;
+
+  n = 0;
+  do {
+    tmp[n++] = '0' + i % 10;
+    i /= 10;
+  } while (i > 0);
+  *buf++ = 'f';
+  while (n > 0)
+    *buf++ = tmp[--n];
+  *buf = 0;
+}
+
+int main(int argc, char *argv[])
+{
+  char name[16];
+  int i, n, fd, start;
+
+  n = argc > 1 ? atoi(argv[1]) : 1000;
+  printf(1, "Directory benchmark: %d files\n", n);
+  if (mkdir("dirbench.d") < 0 || chdir("dirbench.d") < 0)
+    failed();
+
+  start = uptime();
+  for (i = 0; i < n; i++) {
+    fname(name, i);
+    if ((fd = open(name, O_CREATE | O_RDWR)) < 0) {
+      printf(1, "Create of %s failed\n", name);
+      failed();
+    }
+    close(fd);
+  }
+  printf(1, "create: %d ticks\n", uptime() - start);
+
+  start = uptime();
+  for (i = 0; i < n; i++) {
+    fname(name, i);
+    if ((fd = open(name, O_RDONLY)) < 0) {
+      printf(1, "Open of %s failed\n", name);
+      failed();
+    }
+    close(fd);
+  }
+  printf(1, "open:   %d ticks\n", uptime() - start);
+
+  start = uptime();
+  for (i = 0; i < n; i++) {
+    fname(name, i);
+    if (unlink(name) < 0) {
+      printf(1, "Unlink of %s failed\n", name);
+      failed();
+    }
+  }
+  printf(1, "unlink: %d ticks\n", uptime() - start);
+
+  if (chdir("..") < 0 || unlink("dirbench.d") < 0)
+    failed();
+  printf(1, "All tests passed!\n");
+  exit();
+}
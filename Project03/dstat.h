@@ -0,0 +1,17 @@
+// Disk queue statistics, returned by the dstat system call.
+struct dstat {
+  uint bsize;      // Block size of the counts below
+  uint nreq;       // Bufs queued for the disk
+  uint ncmd;       // Disk commands issued, after merging
+  uint nread;      // Blocks read
+  uint nwrite;     // Blocks written
+  uint depth;      // Bufs queued now, the active command's included
+  uint maxdepth;   // Most ever queued at once
+  uint sumdepth;   // Sum of the depth each buf saw on arrival
+  uint svcticks;   // Ticks the disk spent on commands
+  uint waitticks;  // Sum of ticks from queueing to completion
+  uint ndeadline;  // Writes dispatched ahead of reads by deadline
+  uint dma;        // 1 if data moves by bus-master DMA, 0 if by PIO
+  uint rkcycles;   // CPU cycles / 1024 the driver spent on reads
+  uint wkcycles;   // ... and on writes
+};
@@ -7,6 +7,7 @@
 #include "x86.h"
 #include "elf.h"
 #include "spinlock.h"
+#include "mm.h"
 
 struct PTABLE {
   struct spinlock lock;
@@ -24,7 +25,8 @@ exec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
+  pde_t *pgdir;
+  struct mm *mm, *oldmm;
   struct proc *curproc = myproc();
   struct proc *p;
 
@@ -96,6 +98,9 @@ exec(char *path, char **argv)
   if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
     goto bad;
 
+  if((mm = mmalloc(pgdir, sz)) == 0)
+    goto bad;
+
   // Save program name for debugging.
   for(last=s=path; *s; s++)
     if(*s == '/')
@@ -106,30 +111,21 @@ exec(char *path, char **argv)
 
   for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
     if (p != curproc && p -> pid == curproc -> pid) {
-        kfree(p->kstack);
-        p -> kstack = 0;
-        p -> state = UNUSED;
-        p -> sz = 0;
-        p -> pid = 0;
-        p -> parent = 0;
-        p -> name[0] = 0;
-        p -> killed = 0;
-        p -> is_thread = 0;
-        p -> tid = 0;
-        p -> retval = 0;
+      thread_free(p);
     }
   }
+  thread_promote(curproc);
 
   release(&ptable.lock);
 
   // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
+  oldmm = curproc->mm;
+  curproc->mm = mm;
+  curproc->ustack = 0;
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
   switchuvm(curproc);
-  freevm(oldpgdir);
+  mmput(oldmm);
   return 0;
 
  bad:
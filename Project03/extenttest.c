@@ -0,0 +1,109 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+#include "dstat.h"
+
+// Extent limit test: append one block at a time to two files in
+// turn, so that neither file's blocks are contiguous and every
+// block needs an extent of its own. On an extent image (mkfs -e)
+// each file runs out of extents; the write that finds no room
+// must fail without changing the file, and the blocks already
+// written must read back. A block-mapped image takes every block.
+
+#define NFILE 2
+#define EXTRA 4   // blocks tried past the extent limit
+
+char buf[MAXBSIZE];
+char *name[NFILE] = { "extent0.tmp", "extent1.tmp" };
+
+void failed()
+{
+  int f;
+
+  printf(1, "Test failed!\n");
+  for (f = 0; f < NFILE; f++)
+    unlink(name[f]);
+  exit();
+}
+
+void fill(int f, int i, int bsize)
+{
+  memset(buf, 'a' + f, bsize);
+  ((int *)buf)[0] = i;
+}
+
+int main(int argc, char *argv[])
+{
+  struct dstat ds;
+  struct stat st;
+  int fd[NFILE], full[NFILE], f, i, nblock, limit;
+
+  if (dstat(&ds) < 0)
+    failed();
+  limit = NEXTENT + NXEXTENT(ds.bsize);
+  nblock = limit + EXTRA;
+  printf(1, "Extent test: up to %d blocks of %d bytes per file\n",
+         nblock, ds.bsize);
+
+  for (f = 0; f < NFILE; f++) {
+    if ((fd[f] = open(name[f], O_CREATE | O_RDWR)) < 0)
+      failed();
+    full[f] = -1;
+  }
+  for (i = 0; i < nblock; i++) {
+    for (f = 0; f < NFILE; f++) {
+      fill(f, i, ds.bsize);
+      if (full[f] >= 0) {
+        // Once out of room, a file stays out of room.
+        if (write(fd[f], buf, ds.bsize) != -1) {
+          printf(1, "File %d took block %d after filling up\n", f, i);
+          failed();
+        }
+        continue;
+      }
+      if (write(fd[f], buf, ds.bsize) == ds.bsize)
+        continue;
+      if (i < limit) {
+        printf(1, "File %d full at block %d, before %d\n", f, i, limit);
+        failed();
+      }
+      full[f] = i;
+    }
+  }
+
+  for (f = 0; f < NFILE; f++) {
+    if (full[f] < 0)
+      full[f] = nblock;
+    else
+      printf(1, "file %d out of extents at %d blocks\n", f, full[f]);
+    if (fstat(fd[f], &st) < 0 || st.size != full[f] * ds.bsize) {
+      printf(1, "File %d has the wrong size\n", f);
+      failed();
+    }
+    close(fd[f]);
+  }
+
+  for (f = 0; f < NFILE; f++) {
+    if ((fd[f] = open(name[f], O_RDONLY)) < 0)
+      failed();
+    for (i = 0; i < full[f]; i++) {
+      if (read(fd[f], buf, ds.bsize) != ds.bsize) {
+        printf(1, "Read of file %d block %d failed\n", f, i);
+        failed();
+      }
+      if (((int *)buf)[0] != i || buf[ds.bsize - 1] != 'a' + f) {
+        printf(1, "File %d block %d has the wrong contents\n", f, i);
+        failed();
+      }
+    }
+    if (read(fd[f], buf, ds.bsize) != 0)
+      failed();
+    close(fd[f]);
+    if (unlink(name[f]) < 0)
+      failed();
+  }
+  printf(1, "All tests passed!\n");
+  exit();
+}
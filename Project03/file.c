@@ -5,10 +5,14 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "stat.h"
+#include "mmu.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "uio.h"
+#include "poll.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -16,10 +20,23 @@ struct {
   struct file file[NFILE];
 } ftable;
 
+// Processes in poll sleep on pollq, to be woken by pollwakeup
+// whenever a pipe or the console changes state, and, if they
+// gave a timeout, by each clock tick. seq counts the wakeups,
+// so that a poller can tell whether one came while it was
+// looking at its descriptors.
+struct {
+  struct spinlock lock;
+  uint seq;
+  int nwait;   // processes in poll
+  int ntimed;  // ... that gave a timeout
+} pollq;
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  initlock(&pollq.lock, "pollq");
 }
 
 // Allocate a file structure.
@@ -92,66 +109,335 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
-// Read from file f.
+// Read from file f into the cnt buffers of iov, starting at
+// offset off, or at f->off, advancing it, if off is -1.
+// An inode is locked once for the whole vector.
 int
-fileread(struct file *f, char *addr, int n)
+filereadv(struct file *f, struct iovec *iov, int cnt, int off)
 {
-  int r;
+  int i, r, tot;
+  uint pos;
 
   if(f->readable == 0)
     return -1;
-  if(f->type == FD_PIPE)
-    return piperead(f->pipe, addr, n);
+  if(f->type == FD_PIPE){
+    if(off != -1)
+      return -1;
+    // Return what one piperead finds, as read does, rather
+    // than wait for the whole vector to fill.
+    for(i = 0; i < cnt; i++)
+      if(iov[i].len > 0)
+        return piperead(f->pipe, iov[i].base, iov[i].len);
+    return 0;
+  }
   if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
-      f->off += r;
+    pos = off == -1 ? f->off : off;
+    tot = 0;
+    for(i = 0; i < cnt; i++){
+      if((r = readi(f->ip, iov[i].base, pos + tot, iov[i].len)) < 0){
+        if(tot == 0)
+          tot = -1;
+        break;
+      }
+      tot += r;
+      if(r < iov[i].len)
+        break;
+    }
+    if(off == -1 && tot > 0)
+      f->off += tot;
     iunlock(f->ip);
-    return r;
+    return tot;
   }
-  panic("fileread");
+  panic("filereadv");
+}
+
+// Read from file f.
+int
+fileread(struct file *f, char *addr, int n)
+{
+  struct iovec iov;
+
+  iov.base = addr;
+  iov.len = n;
+  return filereadv(f, &iov, 1, -1);
 }
 
 //PAGEBREAK!
-// Write to file f.
+// Most blocks writei() may add to the log writing n bytes at
+// off in ip: the data blocks, the i-node if the file grows,
+// and 2 allocation blocks and the indirect blocks on the
+// paths to the first and last new block if it needs blocks.
+// Rewriting blocks the file already has costs only those.
+static int
+writecost(struct inode *ip, uint off, int n)
+{
+  uint end;
+  int c;
+
+  if(ip->type == T_DEV)
+    return 0;
+  end = off + n;
+  c = (end + bsize - 1) / bsize - off / bsize;
+  if(end > ip->size){
+    c++;
+    if((end + bsize - 1) / bsize > (ip->size + bsize - 1) / bsize)
+      c += 2 + (2*NLEVEL-1);
+  }
+  return c;
+}
+
+// Write the cnt buffers of iov to file f, starting at offset
+// off, or at f->off, advancing it, if off is -1.
 int
-filewrite(struct file *f, char *addr, int n)
+filewritev(struct file *f, struct iovec *iov, int cnt, int off)
 {
-  int r;
+  int i, j, n1, r, max, room, done, tot, len, need;
+  uint pos;
 
   if(f->writable == 0)
     return -1;
-  if(f->type == FD_PIPE)
-    return pipewrite(f->pipe, addr, n);
+  if(f->type == FD_PIPE){
+    if(off != -1)
+      return -1;
+    tot = 0;
+    for(i = 0; i < cnt; i++){
+      if(pipewrite(f->pipe, iov[i].base, iov[i].len) < 0)
+        return tot > 0 ? tot : -1;
+      tot += iov[i].len;
+    }
+    return tot;
+  }
   if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // i-node, 1 block of slop for non-aligned writes,
+    // 2 allocation blocks, and the indirect blocks on
+    // the paths to the first and last data block.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
-        f->off += r;
+    // small buffers share one transaction and one ilock,
+    // which reserves only the log space writecost() says
+    // this write can use.
+    max = (MAXOPBLOCKS-1-1-2-(2*NLEVEL-1)) * bsize;
+    i = 0;
+    done = 0;  // bytes of iov[i] already written
+    tot = 0;
+    r = 0;
+    for(;;){
+      while(i < cnt && iov[i].len == 0)
+        i++;
+      if(i == cnt)
+        break;
+      len = iov[i].len - done;
+      for(j = i+1; j < cnt && len < max; j++)
+        len += iov[j].len;
+      if(len > max)
+        len = max;
+
+      // The size and offset may change before ilock; if the
+      // cost grows, start again with the larger reservation.
+      need = writecost(f->ip, off == -1 ? f->off : off + tot, len);
+      for(;;){
+        begin_opn(need);
+        ilock(f->ip);
+        pos = off == -1 ? f->off : off + tot;
+        if((n1 = writecost(f->ip, pos, len)) <= need)
+          break;
+        iunlock(f->ip);
+        end_op();
+        need = n1;
+      }
+      for(room = len; room > 0; room -= r){
+        n1 = iov[i].len - done;
+        if(n1 > room)
+          n1 = room;
+        if((r = writei(f->ip, (char*)iov[i].base + done, pos, n1)) < 0)
+          break;
+        pos += r;
+        tot += r;
+        if(r != n1){  // the file has no room for more
+          r = -1;
+          break;
+        }
+        if((done += r) == iov[i].len){
+          i++;
+          done = 0;
+        }
+      }
+      if(off == -1)
+        f->off = pos;
       iunlock(f->ip);
       end_op();
 
       if(r < 0)
         break;
-      if(r != n1)
-        panic("short filewrite");
-      i += r;
     }
-    return i == n ? n : -1;
+    return i == cnt ? tot : -1;
   }
-  panic("filewrite");
+  panic("filewritev");
+}
+
+// Write to file f.
+int
+filewrite(struct file *f, char *addr, int n)
+{
+  struct iovec iov;
+
+  iov.base = addr;
+  iov.len = n;
+  return filewritev(f, &iov, 1, -1);
+}
+
+
+static int
+topipe(void *p, char *src, int m)
+{
+  return pipeput(p, src, m);
 }
 
+//PAGEBREAK!
+// Move up to n bytes from file in, starting at offset off, or
+// at in->off, advancing it, if off is -1, to file out without
+// copying them through user space. A pipe is filled straight
+// from the buffer cache; other files are written from a kernel
+// page, since locking both inodes at once could deadlock.
+int
+filesend(struct file *out, struct file *in, int off, int n)
+{
+  struct iovec iov;
+  struct inode *ip;
+  uint pos;
+  int r, tot, eof;
+
+  if(in->type != FD_INODE || in->readable == 0 || out->writable == 0)
+    return -1;
+  ip = in->ip;
+  tot = 0;
+  r = 0;
+  if(out->type == FD_PIPE){
+    // readifn must not sleep with the block locked, so wait
+    // for room first and copy only what fits.
+    while(tot < n && (r = pipewait(out->pipe)) == 0){
+      ilock(ip);
+      pos = off == -1 ? in->off : off + tot;
+      if(ip->type == T_DEV)
+        r = -1;
+      else if(pos < ip->size &&
+              (r = readifn(ip, pos, n - tot, topipe, out->pipe)) > 0){
+        if(off == -1)
+          in->off += r;
+        tot += r;
+      }
+      eof = pos >= ip->size;
+      iunlock(ip);
+      if(r < 0 || eof)
+        break;
+    }
+  } else {
+    if((iov.base = kalloc()) == 0)
+      return -1;
+    while(tot < n){
+      iov.len = n - tot < PGSIZE ? n - tot : PGSIZE;
+      if((r = filereadv(in, &iov, 1, off == -1 ? -1 : off + tot)) <= 0)
+        break;
+      iov.len = r;
+      if(filewritev(out, &iov, 1, -1) != r){
+        r = -1;
+        break;
+      }
+      tot += r;
+    }
+    kfree((char*)iov.base);
+  }
+  return tot > 0 ? tot : r;
+}
+
+//PAGEBREAK!
+// Which of events would not block on f.
+// Files other than pipes and polled devices are always ready.
+int
+filepoll(struct file *f, int events)
+{
+  struct inode *ip;
+  int r;
+
+  if(f->type == FD_PIPE)
+    return pipepoll(f->pipe, f->readable, events);
+  r = 0;
+  if(f->readable)
+    r |= POLLIN;
+  if(f->writable)
+    r |= POLLOUT;
+  if(f->type == FD_INODE){
+    ip = f->ip;
+    ilock(ip);
+    if(ip->type == T_DEV && ip->major >= 0 && ip->major < NDEV &&
+       devsw[ip->major].poll){
+      iunlock(ip);
+      return devsw[ip->major].poll(ip, events) & r;
+    }
+    iunlock(ip);
+  }
+  return r & events;
+}
+
+// Start polling. Return the wakeup count to hand to pollsleep.
+uint
+pollbegin(int timed)
+{
+  uint seq;
+
+  acquire(&pollq.lock);
+  pollq.nwait++;
+  if(timed)
+    pollq.ntimed++;
+  seq = pollq.seq;
+  release(&pollq.lock);
+  return seq;
+}
+
+// Sleep unless pollwakeup has been called since seq was read.
+// Return the wakeup count to use next time.
+uint
+pollsleep(uint seq)
+{
+  acquire(&pollq.lock);
+  if(seq == pollq.seq)
+    sleep(&pollq, &pollq.lock);
+  seq = pollq.seq;
+  release(&pollq.lock);
+  return seq;
+}
+
+void
+pollend(int timed)
+{
+  acquire(&pollq.lock);
+  pollq.nwait--;
+  if(timed)
+    pollq.ntimed--;
+  release(&pollq.lock);
+}
+
+// Wake every poller to look again. Callers hold the lock on
+// the state that changed, which pollers take to look at it,
+// so a poller either sees the change or is counted in nwait.
+void
+pollwakeup(void)
+{
+  if(pollq.nwait == 0)
+    return;
+  acquire(&pollq.lock);
+  pollq.seq++;
+  wakeup(&pollq);
+  release(&pollq.lock);
+}
+
+// Called on each clock tick, for pollers with a timeout.
+void
+polltick(void)
+{
+  if(pollq.ntimed)
+    pollwakeup();
+}
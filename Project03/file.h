@@ -14,15 +14,23 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext;  // icache hash chain
+  struct inode *lnext;  // icache LRU list, while ref is 0
+  struct inode *lprev;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint nextoff;       // where a sequential reader would go on
+  uint rablock;       // first block not yet read ahead
+  uint xidx;          // extent bmap found last
+  uint xbn;           // first file block of extent xidx
+  uint lastblock;     // disk block bmap returned last
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+NLEVEL];
 };
 
 // table mapping major device number to
@@ -30,6 +38,7 @@ struct inode {
 struct devsw {
   int (*read)(struct inode*, char*, int);
   int (*write)(struct inode*, char*, int);
+  int (*poll)(struct inode*, int);  // 0 if always ready
 };
 
 extern struct devsw devsw[];
@@ -23,6 +23,8 @@
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static void dcinit(void);
+static void dcpurge(struct inode*);
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -33,8 +35,8 @@ readsb(int dev, struct superblock *sb)
 {
   struct buf *bp;
 
-  bp = bread(dev, 1);
-  memmove(sb, bp->data, sizeof(*sb));
+  bp = bread(dev, SBOFF / bsize);
+  memmove(sb, bp->data + SBOFF % bsize, sizeof(*sb));
   brelse(bp);
 }
 
@@ -45,32 +47,104 @@ bzero(int dev, int bno)
   struct buf *bp;
 
   bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
+  memset(bp->data, 0, sb.bsize);
   log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
+//
+// The allocator keeps, for each bitmap block, a count of the
+// free blocks it describes, so that full stretches of the disk
+// are skipped without reading their bitmap, and searches the
+// rest a word at a time. A count only changes while its bitmap
+// block is locked. Allocation starts from a goal, normally the
+// block after the one the file used last, so that files stay
+// contiguous; without one it starts where the last allocation
+// left off.
+
+#define NBITMAP 1024  // max bitmap blocks
+
+static struct {
+  uint rotor;             // where goal-less allocations start
+  uint nfree[NBITMAP];    // free blocks per bitmap block
+} bm;
+
+// Count the free blocks in each bitmap block. Called once the
+// log has been recovered.
+void
+bmapinit(int dev)
+{
+  struct buf *bp;
+  uint i, b, bb, w, n;
+
+  if((sb.size + BPB(sb.bsize) - 1) / BPB(sb.bsize) > NBITMAP)
+    panic("bmapinit: too many bitmap blocks");
+  for(bb = 0; bb * BPB(sb.bsize) < sb.size; bb++){
+    bp = bread(dev, sb.bmapstart + bb);
+    n = 0;
+    for(i = 0; i < BPB(sb.bsize) / 32; i++){
+      b = bb * BPB(sb.bsize) + i * 32;
+      if(b >= sb.size)
+        break;
+      w = ~((uint*)bp->data)[i];
+      if(sb.size - b < 32)
+        w &= (1U << (sb.size - b)) - 1;
+      for(; w; w &= w - 1)
+        n++;
+    }
+    bm.nfree[bb] = n;
+    brelse(bp);
+  }
+  bm.rotor = 0;
+}
 
-// Allocate a zeroed disk block.
+// Allocate a zeroed disk block: goal if it is free, else the
+// first free block after it, wrapping around at the end of the
+// disk. With goal 0, start at the rotor.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal)
 {
-  int b, bi, m;
   struct buf *bp;
-
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+  uint *map, nbm, bb, i, wi, w, b, bit;
+
+  if(goal == 0 || goal >= sb.size)
+    goal = bm.rotor;
+  if(goal >= sb.size)
+    goal = 0;
+  nbm = (sb.size + BPB(sb.bsize) - 1) / BPB(sb.bsize);
+  bb = goal / BPB(sb.bsize);
+
+  // Visit goal's bitmap block first, from goal on, and
+  // last, for the blocks before goal.
+  for(i = 0; i <= nbm; i++, bb = (bb + 1) % nbm){
+    if(bm.nfree[bb] == 0)
+      continue;
+    bp = bread(dev, sb.bmapstart + bb);
+    map = (uint*)bp->data;
+    wi = 0;
+    if(i == 0)
+      wi = goal % BPB(sb.bsize) / 32;
+    for(; wi < BPB(sb.bsize) / 32; wi++){
+      b = bb * BPB(sb.bsize) + wi * 32;
+      if(b >= sb.size)
+        break;
+      w = map[wi];
+      if(i == 0 && b < goal)
+        w |= (1U << (goal - b)) - 1;
+      if(w == 0xffffffff)
+        continue;
+      for(bit = 0; w & (1U << bit); bit++)
+        ;
+      if(b + bit >= sb.size)
+        break;
+      map[wi] |= 1U << bit;  // Mark block in use.
+      bm.nfree[bb]--;
+      log_write(bp);
+      brelse(bp);
+      bm.rotor = b + bit + 1;
+      bzero(dev, b + bit);
+      return b + bit;
     }
     brelse(bp);
   }
@@ -85,13 +159,40 @@ bfree(int dev, uint b)
   int bi, m;
 
   bp = bread(dev, BBLOCK(b, sb));
-  bi = b % BPB;
+  bi = b % BPB(sb.bsize);
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
+  bm.nfree[b / BPB(sb.bsize)]++;
+  log_write(bp);
+  brelse(bp);
+}
+
+// Allocate block b, zeroed, if it is free; return 0 if not.
+// The test and the set happen with the bitmap block locked.
+static uint
+ballocexact(uint dev, uint b)
+{
+  struct buf *bp;
+  int bi, m;
+
+  if(b >= sb.size)
+    return 0;
+  bp = bread(dev, BBLOCK(b, sb));
+  bi = b % BPB(sb.bsize);
+  m = 1 << (bi % 8);
+  if(bp->data[bi/8] & m){
+    brelse(bp);
+    return 0;
+  }
+  bp->data[bi/8] |= m;  // Mark block in use.
+  bm.nfree[b / BPB(sb.bsize)]--;
   log_write(bp);
   brelse(bp);
+  bm.rotor = b + 1;
+  bzero(dev, b);
+  return b;
 }
 
 // Inodes.
@@ -158,31 +259,111 @@ bfree(int dev, uint b)
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold icache.lock while using any of those fields.
+// It also protects the hash chains and the LRU list.
+//
+// Entries are hashed by (dev, inum). An entry whose ref drops to
+// zero keeps its contents and goes on an LRU list, so that the next
+// iget of that inode need not read it again. A miss takes the
+// least recently used entry, unless memory is plentiful and the
+// cache is below NINODEMAX, in which case the cache grows by a
+// page of entries instead.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH  127
+#define ILOWMEM 256  // free pages below which the cache won't grow
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode inode[NINODE];   // entries present from boot
+  struct inode *hash[NIHASH];
+  struct inode *lruhead;        // most recently released
+  struct inode *lrutail;
+  int ninode;
+  uint nextinum;  // where ialloc starts looking; just a hint
 } icache;
 
+static struct inode**
+ihash(uint dev, uint inum)
+{
+  return &icache.hash[(dev*31 + inum) % NIHASH];
+}
+
+// Put unreferenced ip on the LRU list, at the head, or at the
+// tail if its contents are not worth keeping.
+// Caller must hold icache.lock.
+static void
+lruput(struct inode *ip, int keep)
+{
+  ip->lprev = ip->lnext = 0;
+  if(icache.lruhead == 0){
+    icache.lruhead = icache.lrutail = ip;
+  } else if(keep){
+    ip->lnext = icache.lruhead;
+    icache.lruhead->lprev = ip;
+    icache.lruhead = ip;
+  } else {
+    ip->lprev = icache.lrutail;
+    icache.lrutail->lnext = ip;
+    icache.lrutail = ip;
+  }
+}
+
+// Take ip off the LRU list. Caller must hold icache.lock.
+static void
+lrudel(struct inode *ip)
+{
+  if(ip->lprev)
+    ip->lprev->lnext = ip->lnext;
+  else
+    icache.lruhead = ip->lnext;
+  if(ip->lnext)
+    ip->lnext->lprev = ip->lprev;
+  else
+    icache.lrutail = ip->lprev;
+  ip->lprev = ip->lnext = 0;
+}
+
+// Add a page of free entries to the cache.
+// Caller must hold icache.lock.
+static int
+igrow(void)
+{
+  struct inode *ip;
+  char *page;
+
+  if((page = kalloctry()) == 0)
+    return 0;
+  memset(page, 0, PGSIZE);
+  for(ip = (struct inode*)page; ip + 1 <= (struct inode*)(page + PGSIZE); ip++){
+    initsleeplock(&ip->lock, "inode");
+    lruput(ip, 0);
+    icache.ninode++;
+  }
+  return 1;
+}
+
 void
 iinit(int dev)
 {
   int i = 0;
   
   initlock(&icache.lock, "icache");
+  dcinit();
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&icache.inode[i].lock, "inode");
+    lruput(&icache.inode[i], 0);
   }
+  icache.ninode = NINODE;
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
- inodestart %d bmap start %d\n", sb.size, sb.nblocks,
+ inodestart %d bmap start %d bsize %d flags %x\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
-          sb.bmapstart);
+          sb.bmapstart, sb.bsize, sb.flags);
+  bsetsize(sb.bsize);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -191,21 +372,25 @@ static struct inode* iget(uint dev, uint inum);
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode.
+// The search starts after the inode allocated last, so that
+// creating many files does not rescan the used ones each time.
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  int i, inum;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
+  for(i = 0; i < sb.ninodes - 1; i++){
+    inum = 1 + (icache.nextinum + i) % (sb.ninodes - 1);
     bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
+    dip = (struct dinode*)bp->data + inum%IPB(sb.bsize);
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
+      icache.nextinum = inum;
       return iget(dev, inum);
     }
     brelse(bp);
@@ -224,7 +409,7 @@ iupdate(struct inode *ip)
   struct dinode *dip;
 
   bp = bread(ip->dev, IBLOCK(ip->inum, sb));
-  dip = (struct dinode*)bp->data + ip->inum%IPB;
+  dip = (struct dinode*)bp->data + ip->inum%IPB(sb.bsize);
   dip->type = ip->type;
   dip->major = ip->major;
   dip->minor = ip->minor;
@@ -241,31 +426,41 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = *ihash(dev, inum); ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lrudel(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Recycle the least recently used entry, or grow.
+  if(icache.lrutail == 0 ||
+     (icache.ninode < NINODEMAX && kfreecount() >= ILOWMEM))
+    igrow();
+  if((ip = icache.lrutail) == 0)
     panic("iget: no inodes");
+  lrudel(ip);
+  if(ip->inum){
+    for(pp = ihash(ip->dev, ip->inum); *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->nextoff = 0;
+  ip->rablock = 0;
+  ip->hnext = *ihash(dev, inum);
+  *ihash(dev, inum) = ip;
   release(&icache.lock);
 
   return ip;
@@ -297,7 +492,7 @@ ilock(struct inode *ip)
 
   if(ip->valid == 0){
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
-    dip = (struct dinode*)bp->data + ip->inum%IPB;
+    dip = (struct dinode*)bp->data + ip->inum%IPB(sb.bsize);
     ip->type = dip->type;
     ip->major = dip->major;
     ip->minor = dip->minor;
@@ -305,6 +500,9 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->xidx = 0;
+    ip->xbn = 0;
+    ip->lastblock = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -331,6 +529,8 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  int keep;
+
   acquiresleep(&ip->lock);
   if(ip->valid && ip->nlink == 0){
     acquire(&icache.lock);
@@ -338,16 +538,20 @@ iput(struct inode *ip)
     release(&icache.lock);
     if(r == 1){
       // inode has no links and no other references: truncate and free.
+      if(ip->type == T_DIR)
+        dcpurge(ip);
       itrunc(ip);
       ip->type = 0;
       iupdate(ip);
       ip->valid = 0;
     }
   }
+  keep = ip->valid;
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0)
+    lruput(ip, keep);
   release(&icache.lock);
 }
 
@@ -365,38 +569,184 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], the NINDIRECT^2 after
+// that in the blocks listed by ip->addrs[NDIRECT+1], and
+// the NINDIRECT^3 after that one level further down from
+// ip->addrs[NDIRECT+2]. File systems made with mkfs -e map
+// blocks with extents instead; see xmap.
+
+// Return extent i of ip. Extents past NEXTENT are in the
+// extent block, which is read into *bpp the first time and
+// left there for the caller to release.
+static struct extent*
+xent(struct inode *ip, uint i, struct buf **bpp)
+{
+  if(i < NEXTENT)
+    return (struct extent*)ip->addrs + i;
+  if(*bpp == 0)
+    *bpp = bread(ip->dev, ip->addrs[XBLOCK]);
+  return (struct extent*)(*bpp)->data + (i - NEXTENT);
+}
+
+// bmap for SB_EXTENT file systems. If run is not 0, also set
+// *run to the number of blocks from bn to the end of its extent,
+// all contiguous on disk. The search starts from the extent found
+// last time, so sequential access looks at one or two extents.
+// A block appended to the file lengthens the last extent if the
+// disk block after it is free, and otherwise starts a new one at
+// the nearest free block after it. Return 0 if that needs an
+// extent and the file has none left.
+static uint
+xmap(struct inode *ip, uint bn, uint *run)
+{
+  struct buf *bp;
+  struct extent *e;
+  uint i, lbn, addr;
+
+  i = 0;
+  lbn = 0;
+  if(ip->xbn <= bn){
+    i = ip->xidx;
+    lbn = ip->xbn;
+  }
+  bp = 0;
+  for(; i < NEXTENT + NXEXTENT(sb.bsize); i++){
+    if(i >= NEXTENT && ip->addrs[XBLOCK] == 0)
+      break;
+    e = xent(ip, i, &bp);
+    if(e->len == 0)
+      break;
+    if(bn < lbn + e->len){
+      addr = e->start + (bn - lbn);
+      if(run)
+        *run = e->len - (bn - lbn);
+      goto found;
+    }
+    lbn += e->len;
+  }
+
+  // bn is just past the end of the file.
+  if(bn != lbn)
+    panic("xmap: hole");
+  addr = 0;
+  if(i > 0){
+    e = xent(ip, i-1, &bp);
+    // With every extent in use the file can only grow by
+    // lengthening the last one.
+    if(i < NEXTENT + NXEXTENT(sb.bsize))
+      addr = balloc(ip->dev, e->start + e->len);
+    else if((addr = ballocexact(ip->dev, e->start + e->len)) == 0){
+      if(bp)
+        brelse(bp);
+      return 0;
+    }
+    if(addr == e->start + e->len){
+      e->len++;
+      if(i-1 >= NEXTENT)
+        log_write(bp);
+      i--;
+      lbn -= e->len - 1;
+      if(run)
+        *run = 1;
+      goto found;
+    }
+  }
+  if(addr == 0)
+    addr = balloc(ip->dev, 0);
+  if(i == NEXTENT)
+    ip->addrs[XBLOCK] = balloc(ip->dev, addr + 1);
+  e = xent(ip, i, &bp);
+  e->start = addr;
+  e->len = 1;
+  if(i >= NEXTENT)
+    log_write(bp);
+  if(run)
+    *run = 1;
+
+found:
+  ip->xidx = i;
+  ip->xbn = lbn;
+  if(bp)
+    brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one, or returns 0
+// if the file has no room for it.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr, *a, nind, span, goal;
+  int level;
   struct buf *bp;
 
+  if(sb.flags & SB_EXTENT)
+    return xmap(ip, bn, 0);
+
+  // Allocate new blocks after the one used last.
+  goal = ip->lastblock ? ip->lastblock + 1 : 0;
+
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = balloc(ip->dev, goal);
+    ip->lastblock = addr;
     return addr;
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+  // Find the tree holding bn: span blocks hang below
+  // ip->addrs[NDIRECT+level-1].
+  nind = NINDIRECT(sb.bsize);
+  span = nind;
+  for(level = 1; bn >= span; level++){
+    if(level == NLEVEL)
+      panic("bmap: out of range");
+    bn -= span;
+    span *= nind;
+  }
+
+  // Walk down, allocating indirect blocks as necessary.
+  if((addr = ip->addrs[NDIRECT+level-1]) == 0){
+    ip->addrs[NDIRECT+level-1] = addr = balloc(ip->dev, goal);
+    goal = addr + 1;
+  }
+  for(; level > 0; level--){
+    span /= nind;
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+    if((addr = a[bn / span]) == 0){
+      a[bn / span] = addr = balloc(ip->dev, goal);
+      goal = addr + 1;
       log_write(bp);
     }
     brelse(bp);
-    return addr;
+    bn %= span;
   }
+  ip->lastblock = addr;
+  return addr;
+}
 
-  panic("bmap: out of range");
+// Free block addr and, if level > 0, everything reachable
+// from it as an indirect block level levels above the data.
+// Each indirect block is read once.
+static void
+bfreetree(uint dev, uint addr, int level)
+{
+  struct buf *bp;
+  uint *a;
+  int i;
+
+  if(level > 0){
+    bp = bread(dev, addr);
+    a = (uint*)bp->data;
+    for(i = 0; i < NINDIRECT(sb.bsize); i++){
+      if(a[i])
+        bfreetree(dev, a[i], level-1);
+    }
+    brelse(bp);
+  }
+  bfree(dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -407,27 +757,35 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
   struct buf *bp;
-  uint *a;
-
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
+  struct extent *e;
+  uint i, j;
+
+  if(sb.flags & SB_EXTENT){
+    bp = 0;
+    for(i = 0; i < NEXTENT + NXEXTENT(sb.bsize); i++){
+      if(i >= NEXTENT && ip->addrs[XBLOCK] == 0)
+        break;
+      e = xent(ip, i, &bp);
+      if(e->len == 0)
+        break;
+      for(j = 0; j < e->len; j++)
+        bfree(ip->dev, e->start + j);
     }
-  }
-
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+    if(bp)
+      brelse(bp);
+    if(ip->addrs[XBLOCK])
+      bfree(ip->dev, ip->addrs[XBLOCK]);
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->xidx = 0;
+    ip->xbn = 0;
+  } else {
+    for(i = 0; i < NDIRECT+NLEVEL; i++){
+      if(ip->addrs[i]){
+        bfreetree(ip->dev, ip->addrs[i], i < NDIRECT ? 0 : i-NDIRECT+1);
+        ip->addrs[i] = 0;
+      }
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
 
   ip->size = 0;
@@ -446,33 +804,110 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Return the disk address of block bn of ip, which must exist,
+// and set *run to the number of blocks from there on that are
+// known to be contiguous on disk.
+static uint
+bmaprun(struct inode *ip, uint bn, uint *run)
+{
+  if(sb.flags & SB_EXTENT)
+    return xmap(ip, bn, run);
+  *run = 1;
+  return bmap(ip, bn);
+}
+
+// Queue asynchronous reads for the READAHEAD blocks from bn on,
+// so that the disk works while a sequential reader consumes
+// them. Blocks already queued are not asked for again.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint bn)
+{
+  uint end, addr, run;
+
+  end = min(bn + READAHEAD, (ip->size + sb.bsize - 1) / sb.bsize);
+  if(ip->rablock < bn)
+    ip->rablock = bn;
+  for(; ip->rablock < end; ip->rablock += run){
+    addr = bmaprun(ip, ip->rablock, &run);
+    run = min(run, end - ip->rablock);
+    breadv_async(ip->dev, addr, run);
+  }
+}
+
 //PAGEBREAK!
-// Read data from inode.
+// Hand up to n bytes of ip from off to copy(arg, src, m), a
+// block at a time and straight out of the buffer cache, stopping
+// early if copy takes fewer than m. copy runs with the buf
+// locked, so it must not sleep. Return the bytes taken, or -1.
 // Caller must hold ip->lock.
 int
-readi(struct inode *ip, char *dst, uint off, uint n)
+readifn(struct inode *ip, uint off, uint n,
+        int (*copy)(void*, char*, int), void *arg)
 {
-  uint tot, m;
+  uint tot, m, addr, run;
   struct buf *bp;
+  int r, seq;
 
-  if(ip->type == T_DEV){
-    if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
-      return -1;
-    return devsw[ip->major].read(ip, dst, n);
-  }
-
+  if(ip->type == T_DEV)
+    return -1;
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > ip->size)
     n = ip->size - off;
 
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(dst, bp->data + off%BSIZE, m);
+  seq = off == ip->nextoff;
+  if(!seq)
+    ip->rablock = 0;
+  addr = run = 0;
+  for(tot=0; tot<n; tot+=m, off+=m){
+    if(seq)
+      readahead(ip, off/sb.bsize);
+    if(run == 0)
+      addr = bmaprun(ip, off/sb.bsize, &run);
+    bp = bread(ip->dev, addr);
+    m = min(n - tot, sb.bsize - off%sb.bsize);
+    r = copy(arg, (char*)bp->data + off%sb.bsize, m);
     brelse(bp);
+    if(r < 0 && tot == 0)
+      return -1;
+    if(r != m){
+      if(r > 0){
+        tot += r;
+        off += r;
+      }
+      break;
+    }
+    if((off + m) % sb.bsize == 0){
+      addr++;
+      run--;
+    }
+  }
+  ip->nextoff = off;
+  return tot;
+}
+
+static int
+memcopy(void *arg, char *src, int m)
+{
+  char **dst = arg;
+
+  memmove(*dst, src, m);
+  *dst += m;
+  return m;
+}
+
+// Read data from inode.
+// Caller must hold ip->lock.
+int
+readi(struct inode *ip, char *dst, uint off, uint n)
+{
+  if(ip->type == T_DEV){
+    if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
+      return -1;
+    return devsw[ip->major].read(ip, dst, n);
   }
-  return n;
+  return readifn(ip, off, n, memcopy, &dst);
 }
 
 // PAGEBREAK!
@@ -481,7 +916,7 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -492,13 +927,15 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(n > 0 && (off + n - 1)/sb.bsize >= MAXFILE(sb.bsize))
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(bp->data + off%BSIZE, src, m);
+    if((addr = bmap(ip, off/sb.bsize)) == 0)
+      break;  // out of extents
+    bp = bread(ip->dev, addr);
+    m = min(n - tot, sb.bsize - off%sb.bsize);
+    memmove(bp->data + off%sb.bsize, src, m);
     log_write(bp);
     brelse(bp);
   }
@@ -507,7 +944,7 @@ writei(struct inode *ip, char *src, uint off, uint n)
     ip->size = off;
     iupdate(ip);
   }
-  return n;
+  return tot > 0 || n == 0 ? tot : -1;
 }
 
 //PAGEBREAK!
@@ -519,41 +956,406 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Hashed directories.
+//
+// On an SB_DXDIR file system, a directory that fills its first
+// block is converted: its entries move to two bucket blocks and
+// block 0 becomes the index (see fs.h). A full bucket is split
+// in two, doubling the index first if the bucket's depth has
+// caught up with it, so a lookup reads two blocks however large
+// the directory grows. Directories that are not hashed are
+// scanned linearly, as before.
+//
+// DIROPBLOCKS bounds what a dirlink() can log: a hashed
+// directory stays within one indirect block, so the two
+// i-nodes, a new directory's first block, the index and two
+// buckets of a conversion, DXMAXSPLIT new buckets, 3 allocation
+// blocks and the indirect block cover the worst case.
+
+#define DXMAXSPLIT 2  // bucket splits per dirlink, bounded by the log
+
+static uint
+dxhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;  // FNV-1a; mkfs.c has a copy
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// Return a pointer to entry k of the table in index block ib.
+static ushort*
+dxtable(struct buf *ib, uint k)
+{
+  return (ushort*)ib->data + (1 + k/7) * 8 + 1 + k%7;
+}
+
+// If dp is a hashed directory, return its index block, locked.
+static struct buf*
+dxindex(struct inode *dp)
+{
+  struct buf *ib;
+  struct dxslot *h;
+
+  if(dp->size < 3*sb.bsize)
+    return 0;
+  ib = bread(dp->dev, bmap(dp, 0));
+  h = (struct dxslot*)ib->data;
+  if(h->zero == 0 && h->v[0] == DXMAGIC)
+    return ib;
+  brelse(ib);
+  return 0;
+}
+
+// Return the directory block holding name's bucket.
+static uint
+dxbucket(struct buf *ib, char *name)
+{
+  struct dxslot *h = (struct dxslot*)ib->data;
+
+  return *dxtable(ib, dxhash(name) & ((1 << h->v[1]) - 1));
+}
+
+// Turn dp, a plain directory that exactly fills one block, into a
+// hashed directory with two buckets. Return -1, leaving dp as it
+// is, if its entries do not fit.
+static int
+dxconvert(struct inode *dp)
+{
+  struct buf *ib, *bp[2];
+  struct dirent *de, *bde;
+  struct dxslot *h;
+  uint i, b, n[2], addr[2];
+
+  ib = bread(dp->dev, bmap(dp, 0));
+  de = (struct dirent*)ib->data;
+  n[0] = n[1] = 0;
+  for(i = 0; i < sb.bsize / sizeof(*de); i++)
+    if(de[i].inum)
+      n[dxhash(de[i].name) & 1]++;
+  if(n[0] > DXENTRIES(sb.bsize) || n[1] > DXENTRIES(sb.bsize)){
+    brelse(ib);
+    return -1;
+  }
+
+  // Only now give dp its bucket blocks, which it may be out
+  // of extents for.
+  for(b = 0; b < 2; b++){
+    if((addr[b] = bmap(dp, 1 + b)) == 0){
+      brelse(ib);
+      return -1;
+    }
+  }
+
+  for(b = 0; b < 2; b++){
+    bp[b] = bread(dp->dev, addr[b]);
+    h = (struct dxslot*)bp[b]->data;
+    h->v[0] = DXMAGIC;
+    h->v[1] = 1;
+    n[b] = 1;
+  }
+  for(i = 0; i < sb.bsize / sizeof(*de); i++){
+    if(de[i].inum){
+      b = dxhash(de[i].name) & 1;
+      bde = (struct dirent*)bp[b]->data;
+      bde[n[b]++] = de[i];
+    }
+  }
+
+  memset(ib->data, 0, sb.bsize);
+  h = (struct dxslot*)ib->data;
+  h->v[0] = DXMAGIC;
+  h->v[1] = 1;
+  *dxtable(ib, 0) = 1;
+  *dxtable(ib, 1) = 2;
+
+  for(b = 0; b < 2; b++){
+    log_write(bp[b]);
+    brelse(bp[b]);
+  }
+  log_write(ib);
+  brelse(ib);
+  dp->size = 3*sb.bsize;
+  iupdate(dp);
+  return 0;
+}
+
+// Add (name, inum) to hashed directory dp, whose index block ib
+// the caller has locked; release ib. Return -1 if name's bucket
+// is full and cannot be split.
+static int
+dxinsert(struct inode *dp, struct buf *ib, char *name, uint inum)
+{
+  struct buf *bp, *np;
+  struct dirent *de, *nde;
+  struct dxslot *ih, *bh, *nh;
+  uint h, k, lb, nb, addr, depth, ldepth, i, j;
+  int split;
+
+  h = dxhash(name);
+  ih = (struct dxslot*)ib->data;
+  for(split = 0; ; split++){
+    depth = ih->v[1];
+    lb = *dxtable(ib, h & ((1 << depth) - 1));
+    bp = bread(dp->dev, bmap(dp, lb));
+    de = (struct dirent*)bp->data;
+    for(i = 1; i <= DXENTRIES(sb.bsize); i++){
+      if(de[i].inum == 0){
+        strncpy(de[i].name, name, DIRSIZ);
+        de[i].inum = inum;
+        log_write(bp);
+        brelse(bp);
+        brelse(ib);
+        return 0;
+      }
+    }
+
+    // The bucket is full. Double the index if the bucket is
+    // as deep as it, then split the bucket on the next hash bit.
+    bh = (struct dxslot*)bp->data;
+    ldepth = bh->v[1];
+    nb = dp->size / sb.bsize;
+    if(split == DXMAXSPLIT || nb >= NDIRECT + NINDIRECT(sb.bsize) ||
+       (ldepth == depth && (2 << depth) > DXTABLE(sb.bsize)) ||
+       (addr = bmap(dp, nb)) == 0){
+      brelse(bp);
+      brelse(ib);
+      return -1;
+    }
+    if(ldepth == depth){
+      for(k = 0; k < (1 << depth); k++)
+        *dxtable(ib, k + (1 << depth)) = *dxtable(ib, k);
+      ih->v[1] = ++depth;
+    }
+
+    np = bread(dp->dev, addr);
+    dp->size += sb.bsize;
+    iupdate(dp);
+    nh = (struct dxslot*)np->data;
+    nh->v[0] = DXMAGIC;
+    nh->v[1] = ldepth + 1;
+    bh->v[1] = ldepth + 1;
+    nde = (struct dirent*)np->data;
+    for(i = j = 1; i <= DXENTRIES(sb.bsize); i++){
+      if((dxhash(de[i].name) >> ldepth) & 1){
+        nde[j++] = de[i];
+        memset(&de[i], 0, sizeof(de[i]));
+      }
+    }
+    for(k = 0; k < (1 << depth); k++)
+      if(*dxtable(ib, k) == lb && ((k >> ldepth) & 1))
+        *dxtable(ib, k) = nb;
+
+    log_write(np);
+    brelse(np);
+    log_write(bp);
+    brelse(bp);
+    log_write(ib);
+  }
+}
+
+// Name cache.
+//
+// The name cache remembers what dirlookup found: the inode
+// number a name in a directory refers to, or 0 if the name is
+// not there. A hit saves reading and scanning the directory.
+// Entries change only while the directory is locked: dirlink
+// enters new names, unlink forgets removed ones, and freeing a
+// directory forgets everything in it, since its inode number
+// may be reused. Entries are replaced with a clock, as in bio.c.
+
+#define NDHASH 61
+
+struct dentry {
+  uint dev;
+  uint dinum;             // Directory's inode number
+  char name[DIRSIZ];
+  uint inum;              // 0: name is not in the directory
+  int recent;             // used since the clock hand last passed
+  struct dentry *hnext;
+};
+
+static struct {
+  struct spinlock lock;
+  struct dentry ent[NDCACHE];
+  struct dentry *head[NDHASH];
+  uint hand;
+} dcache;
+
+static void
+dcinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static struct dentry**
+dhash(uint dev, uint dinum, char *name)
+{
+  return &dcache.head[(dxhash(name) ^ dinum ^ dev) % NDHASH];
+}
+
+// Find (dev, dinum, name). Caller must hold dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dinum, char *name)
+{
+  struct dentry *d;
+
+  for(d = *dhash(dev, dinum, name); d; d = d->hnext)
+    if(d->dev == dev && d->dinum == dinum && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Take d out of its hash chain. Caller must hold dcache.lock.
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = dhash(d->dev, d->dinum, d->name); *pp; pp = &(*pp)->hnext){
+    if(*pp == d){
+      *pp = d->hnext;
+      break;
+    }
+  }
+  d->dev = 0;
+  d->dinum = 0;
+}
+
+// Look name up in dp's cache entries. Return 1 and set *inum
+// on a hit, 0 on a miss.
+static int
+dclookup(struct inode *dp, char *name, uint *inum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) != 0){
+    d->recent = 1;
+    *inum = d->inum;
+  }
+  release(&dcache.lock);
+  return d != 0;
+}
+
+// Record that name in dp refers to inum (0 if absent).
+static void
+dcenter(struct inode *dp, char *name, uint inum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    for(;;){
+      d = &dcache.ent[dcache.hand];
+      dcache.hand = (dcache.hand + 1) % NDCACHE;
+      if(!d->recent)
+        break;
+      d->recent = 0;
+    }
+    if(d->dinum)
+      dunhash(d);
+    d->dev = dp->dev;
+    d->dinum = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    d->hnext = *dhash(d->dev, d->dinum, d->name);
+    *dhash(d->dev, d->dinum, d->name) = d;
+  }
+  d->inum = inum;
+  d->recent = 1;
+  release(&dcache.lock);
+}
+
+// Forget name in dp, after it has been removed.
+void
+dcforget(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) != 0)
+    dunhash(d);
+  release(&dcache.lock);
+}
+
+// Forget every name in directory dp, which is being freed.
+static void
+dcpurge(struct inode *dp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.ent; d < &dcache.ent[NDCACHE]; d++)
+    if(d->dinum == dp->inum && d->dev == dp->dev)
+      dunhash(d);
+  release(&dcache.lock);
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
-  struct dirent de;
+  uint bn, nbn, i, n, inum;
+  struct buf *bp;
+  struct dirent *de;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+  // Callers that want the offset are about to change the entry.
+  if(poff == 0 && dclookup(dp, name, &inum))
+    return inum ? iget(dp->dev, inum) : 0;
+
+  // A hashed directory has one block to look at;
+  // others are searched a block at a time.
+  if((bp = dxindex(dp)) != 0){
+    bn = dxbucket(bp, name);
+    brelse(bp);
+    nbn = bn + 1;
+  } else {
+    bn = 0;
+    nbn = (dp->size + sb.bsize - 1) / sb.bsize;
+  }
+
+  for(; bn < nbn; bn++){
+    bp = bread(dp->dev, bmap(dp, bn));
+    de = (struct dirent*)bp->data;
+    n = min(sb.bsize, dp->size - bn*sb.bsize) / sizeof(*de);
+    for(i = 0; i < n; i++){
+      if(de[i].inum == 0)
+        continue;
+      if(namecmp(name, de[i].name) == 0){
+        // entry matches path element
+        if(poff)
+          *poff = bn*sb.bsize + i*sizeof(*de);
+        inum = de[i].inum;
+        brelse(bp);
+        dcenter(dp, name, inum);
+        return iget(dp->dev, inum);
+      }
     }
+    brelse(bp);
   }
 
+  dcenter(dp, name, 0);
   return 0;
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
+// Return -1 if name is present or there is no room.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
   int off;
   struct dirent de;
   struct inode *ip;
+  struct buf *ib;
 
   // Check that name is not present.
   if((ip = dirlookup(dp, name, 0)) != 0){
@@ -561,6 +1363,13 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
+  if((ib = dxindex(dp)) != 0){
+    if(dxinsert(dp, ib, name, inum) < 0)
+      return -1;
+    dcenter(dp, name, inum);
+    return 0;
+  }
+
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
@@ -569,10 +1378,20 @@ dirlink(struct inode *dp, char *name, uint inum)
       break;
   }
 
+  // Hash the directory rather than give it a second block.
+  if(off == sb.bsize && dp->size == sb.bsize &&
+     (sb.flags & SB_DXDIR) && dxconvert(dp) == 0){
+    if(dxinsert(dp, dxindex(dp), name, inum) < 0)
+      return -1;
+    dcenter(dp, name, inum);
+    return 0;
+  }
+
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-    panic("dirlink");
+    return -1;  // out of extents
+  dcenter(dp, name, inum);
 
   return 0;
 }
@@ -3,12 +3,18 @@
 
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#define MINBSIZE 512   // smallest block size, one disk sector
+#define MAXBSIZE 4096  // largest block size, one page
+#define SBOFF 512      // byte offset of the super block
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
 //                                          free bit map | data blocks]
 //
+// The super block is always in the disk's second sector. With
+// 512-byte blocks that is block 1; with larger blocks it shares
+// block 0 with the boot sector and the log starts at block 1.
+//
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
 struct superblock {
@@ -19,11 +25,18 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint bsize;        // Block size (bytes)
+  uint flags;        // SB_*
 };
 
-#define NDIRECT 12
-#define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define SB_EXTENT 0x1  // inodes map their blocks with extents
+#define SB_DXDIR  0x2  // hash directories that outgrow a block
+
+#define NDIRECT 10
+#define NLEVEL 3    // single, double and triple indirect
+#define NINDIRECT(bs) ((bs) / sizeof(uint))
+#define MAXFILE(bs) (NDIRECT + NINDIRECT(bs) + NINDIRECT(bs)*NINDIRECT(bs) + \
+                     NINDIRECT(bs)*NINDIRECT(bs)*NINDIRECT(bs))
 
 // On-disk inode structure
 struct dinode {
@@ -32,20 +45,33 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+NLEVEL];   // Data block addresses
+};
+
+// On an SB_EXTENT file system addrs[] instead holds NEXTENT
+// extents, runs of contiguous blocks in file order, followed by
+// the address of a block with NXEXTENT more. An extent with
+// len 0 ends the list.
+struct extent {
+  uint start;           // First disk block
+  uint len;             // Number of blocks
 };
 
-// Inodes per block.
-#define IPB           (BSIZE / sizeof(struct dinode))
+#define NEXTENT ((NDIRECT+NLEVEL-1) / 2)
+#define NXEXTENT(bs) ((bs) / sizeof(struct extent))
+#define XBLOCK (NDIRECT+NLEVEL-1)   // addrs[] slot of the extent block
+
+// Inodes per block of bs bytes.
+#define IPB(bs)       ((bs) / sizeof(struct dinode))
 
 // Block containing inode i
-#define IBLOCK(i, sb)     ((i) / IPB + sb.inodestart)
+#define IBLOCK(i, sb)     ((i) / IPB((sb).bsize) + (sb).inodestart)
 
-// Bitmap bits per block
-#define BPB           (BSIZE*8)
+// Bitmap bits per block of bs bytes
+#define BPB(bs)       ((bs)*8)
 
 // Block of free map containing bit for block b
-#define BBLOCK(b, sb) (b/BPB + sb.bmapstart)
+#define BBLOCK(b, sb) ((b)/BPB((sb).bsize) + (sb).bmapstart)
 
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
@@ -55,3 +81,20 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// A hashed directory's block 0 is an index of 1<<depth bucket
+// block numbers, picked by the low bits of a hash of the name;
+// the other blocks are buckets of dirents. The index and each
+// bucket start with a header slot, and every index slot reads
+// as a free dirent, so programs that scan a directory still
+// see only its entries.
+struct dxslot {
+  ushort zero;          // Always 0, the inum of a free dirent
+  ushort v[7];
+};
+
+// Header slots hold DXMAGIC in v[0] and, in v[1], the depth of
+// the index or bucket. The index table follows its header,
+// 7 entries to a slot.
+#define DXMAGIC 0xd1c7
+#define DXTABLE(bs) (((bs) / sizeof(struct dxslot) - 1) * 7)
+#define DXENTRIES(bs) ((bs) / sizeof(struct dirent) - 1)
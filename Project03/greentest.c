@@ -0,0 +1,66 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Green thread test: far more tasks than NPROC, each yielding
+// many times, multiplexed onto a few kernel threads.
+
+#define NUM_TASK 2000
+#define NUM_YIELD 10
+#define NUM_WORKER 2
+
+int done[NUM_TASK];
+
+void failed()
+{
+  printf(1, "Test failed!\n");
+  exit();
+}
+
+void task(void *arg)
+{
+  int val = (int)arg;
+  int i;
+
+  for (i = 0; i < NUM_YIELD; i++) {
+    done[val]++;
+    gyield();
+  }
+}
+
+void spawner(void *arg)
+{
+  int i;
+
+  for (i = 0; i < NUM_TASK; i++) {
+    if (gspawn(task, (void *)i) != 0) {
+      printf(1, "Error spawning task %d\n", i);
+      failed();
+    }
+    if (i % 100 == 0)
+      gyield();
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int i, start, nworker;
+
+  printf(1, "Green thread test: %d tasks, %d yields each\n",
+         NUM_TASK, NUM_YIELD);
+  if (gspawn(spawner, 0) != 0)
+    failed();
+
+  start = uptime();
+  nworker = grun(NUM_WORKER);
+  for (i = 0; i < NUM_TASK; i++) {
+    if (done[i] != NUM_YIELD) {
+      printf(1, "Task %d ran %d times, expected %d\n", i, done[i], NUM_YIELD);
+      failed();
+    }
+  }
+  printf(1, "%d switches on %d workers in %d ticks\n",
+         NUM_TASK * NUM_YIELD, nworker, uptime() - start);
+  printf(1, "All tests passed!\n");
+  exit();
+}
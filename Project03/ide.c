@@ -1,4 +1,5 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code. Moves data by PCI bus-master DMA
+// when the controller supports it, else by PIO.
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +13,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "dstat.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -23,13 +25,55 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+
+// Bus master registers of the primary channel, from idebm.
+#define BM_CMD        0
+#define BM_STATUS     2
+#define BM_PRDT       4
+#define BM_START      0x01  // in BM_CMD
+#define BM_READ       0x08  // in BM_CMD: device to memory
+#define BM_ERR        0x02  // in BM_STATUS
+#define BM_INTR       0x04  // in BM_STATUS
+
+// Sectors moved per interrupt by RDMUL/WRMUL, and the most
+// one command may cover.
+#define IDE_MAXMULT   16
+#define IDE_MAXSECT   256
+
+// Ticks a queued write may be passed over by reads.
+#define IDE_WDEADLINE 50
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
+// When a buf reaches the head, queued bufs for the blocks that
+// follow it are moved onto its mnext chain and transferred by the
+// same disk command, IDE_MAXMULT sectors per interrupt; idenext
+// is the first buf of the chain not yet transferred.
+// The rest of the queue is kept in arrival order; idepick()
+// chooses which buf goes next.
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static struct buf *idenext;
+static uint idepos;        // block after the last one transferred
+static uint idestartticks; // when the active command started
+static struct dstat idestat;
+static unsigned long long idecycles[2]; // CPU cycles for reads, writes
+
+// Physical region descriptor: one run of memory in a DMA transfer.
+struct prd {
+  uint addr;
+  ushort count;  // bytes
+  ushort flags;
+};
+#define PRD_EOT       0x8000  // last entry of the table
+
+static ushort idebm;  // bus master I/O base, 0 to use PIO
+static struct prd prdt[IDE_MAXSECT] __attribute__((aligned(PGSIZE)));
 
 static int havedisk1;
 static void idestart(struct buf*);
@@ -51,6 +95,7 @@ void
 ideinit(void)
 {
   int i;
+  uint tag;
 
   initlock(&idelock, "ide");
   ioapicenable(IRQ_IDE, ncpu - 1);
@@ -65,45 +110,227 @@ ideinit(void)
     }
   }
 
-  // Switch back to disk 0.
-  outb(0x1f6, 0xe0 | (0<<4));
+  // Move IDE_MAXMULT sectors per interrupt in RDMUL/WRMUL.
+  for(i = havedisk1; i >= 0; i--){
+    outb(0x1f6, 0xe0 | (i<<4));
+    outb(0x1f2, IDE_MAXMULT);
+    outb(0x1f7, IDE_CMD_SETMUL);
+    idewait(0);
+  }
+  // Leaves disk 0 selected.
+
+  // Use bus-master DMA if there is a PCI IDE controller.
+  if(IDEDMA && (tag = pcifind(0x08, 0x01010000, 0xffff0000)) != 0){
+    idebm = pciread(tag, 0x20) & 0xfffc;  // BAR4
+    if(idebm)
+      pcienable(tag);
+  }
+}
+
+// Add the CPU time spent since t0 to the driver's total.
+static void
+idecharge(int write, unsigned long long t0)
+{
+  idecycles[write != 0] += rdtsc() - t0;
+}
+
+// Describe b's chain in prdt, merging bufs that are adjacent in
+// memory, and point the bus master at it.  No run may cross a
+// 64K boundary.
+static void
+idedma(struct buf *b)
+{
+  struct prd *p;
+  uint pa;
+
+  p = 0;
+  for(; b; b = b->mnext){
+    pa = V2P(b->data);
+    if(p && p->addr + p->count == pa && (pa & 0xffff) != 0 &&
+       p->count + bsize < 0x10000){
+      p->count += bsize;
+      continue;
+    }
+    p = p ? p + 1 : prdt;
+    p->addr = pa;
+    p->count = bsize;
+    p->flags = 0;
+  }
+  p->flags = PRD_EOT;
+  outl(idebm + BM_PRDT, V2P(prdt));
+}
+
+// Move queued bufs for the blocks after b's onto b's chain.
+static void
+idemerge(struct buf *b)
+{
+  struct buf **pp, *q, *last;
+  int nblock, max;
+
+  max = IDE_MAXSECT / (bsize/SECTOR_SIZE);
+  nblock = 1;
+  for(last = b; last->mnext; last = last->mnext)
+    nblock++;
+
+  pp = &b->qnext;
+  while((q = *pp) != 0 && nblock < max){
+    if(q->dev == b->dev && q->blockno == last->blockno + 1 &&
+       (q->flags & B_DIRTY) == (b->flags & B_DIRTY)){
+      *pp = q->qnext;
+      q->qnext = 0;
+      last->mnext = q;
+      last = q;
+      nblock++;
+      pp = &b->qnext;  // the next block may be queued earlier
+    } else
+      pp = &q->qnext;
+  }
+}
+
+// Transfer the bufs of one IDE_MAXMULT-sector DRQ block,
+// starting at idenext.  Caller must hold idelock.
+static void
+idepio(int write)
+{
+  int i;
+
+  for(i = 0; idenext && i < IDE_MAXMULT; i += bsize/SECTOR_SIZE){
+    if(write)
+      outsl(0x1f0, idenext->data, bsize/4);
+    else
+      insl(0x1f0, idenext->data, bsize/4);
+    idenext = idenext->mnext;
+  }
+}
+
+// C-LOOK: the lowest block at or after the disk position,
+// else the lowest block, among queued bufs of one direction.
+static struct buf**
+idelook(int write)
+{
+  struct buf **pp, **up, **low;
+
+  up = low = 0;
+  for(pp = &idequeue; *pp; pp = &(*pp)->qnext){
+    if(((*pp)->flags & B_DIRTY) != (write ? B_DIRTY : 0))
+      continue;
+    if(low == 0 || (*pp)->blockno < (*low)->blockno)
+      low = pp;
+    if((*pp)->blockno >= idepos && (up == 0 || (*pp)->blockno < (*up)->blockno))
+      up = pp;
+  }
+  return up ? up : low;
+}
+
+// Choose the next request and move it to the head of idequeue.
+// Reads go first, in C-LOOK order, unless the oldest write has
+// waited IDE_WDEADLINE ticks. Caller must hold idelock and the
+// disk must be idle.
+static struct buf*
+idepick(void)
+{
+  struct buf **pp, *b;
+
+  for(pp = &idequeue; *pp; pp = &(*pp)->qnext)
+    if((*pp)->flags & B_DIRTY)
+      break;
+  if(*pp && ticks - (*pp)->qtime >= IDE_WDEADLINE)
+    idestat.ndeadline++;
+  else if((pp = idelook(0)) == 0)
+    pp = idelook(1);
+
+  b = *pp;
+  *pp = b->qnext;
+  b->qnext = idequeue;
+  idequeue = b;
+  return b;
+}
+
+// Append b to idequeue.  Caller must hold idelock.
+static void
+ideenqueue(struct buf *b)
+{
+  struct buf **pp;
+
+  b->qnext = 0;
+  b->mnext = 0;
+  b->qtime = ticks;
+  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
+    ;
+  *pp = b;
+
+  idestat.nreq++;
+  idestat.depth++;
+  idestat.sumdepth += idestat.depth;
+  if(idestat.depth > idestat.maxdepth)
+    idestat.maxdepth = idestat.depth;
 }
 
 // Start the request for b.  Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *c;
+  int nblock;
+  unsigned long long t0 = rdtsc();
+
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
-    panic("incorrect blockno");
-  int sector_per_block =  BSIZE/SECTOR_SIZE;
+  idemerge(b);
+  nblock = 0;
+  for(c = b; c; c = c->mnext)
+    nblock++;
+  int sector_per_block =  bsize/SECTOR_SIZE;
+  int nsector = nblock * sector_per_block;
   int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  if(sector + nsector > (1<<28))
+    panic("incorrect blockno");
+  int read_cmd = (nsector == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
+  int write_cmd = (nsector == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
-  if (sector_per_block > 7) panic("idestart");
+  if (sector_per_block > IDE_MAXMULT || nsector > IDE_MAXSECT)
+    panic("idestart");
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, nsector & 0xff);  // number of sectors, 0 means 256
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
+  idestartticks = ticks;
+  idestat.ncmd++;
+  if(b->flags & B_DIRTY)
+    idestat.nwrite += nblock;
+  else
+    idestat.nread += nblock;
+
+  if(idebm){
+    // The interrupt comes when the whole chain is done.
+    idenext = 0;
+    idedma(b);
+    outb(idebm + BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_READ);
+    outb(idebm + BM_STATUS, inb(idebm + BM_STATUS) | BM_INTR | BM_ERR);
+    outb(0x1f7, (b->flags & B_DIRTY) ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(idebm + BM_CMD, inb(idebm + BM_CMD) | BM_START);
+  } else if(b->flags & B_DIRTY){
+    idenext = b;
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    idepio(1);
   } else {
+    idenext = b;
     outb(0x1f7, read_cmd);
   }
+  idecharge(b->flags & B_DIRTY, t0);
 }
 
 // Interrupt handler.
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *c;
+  unsigned long long t0 = rdtsc();
+  int write, st;
 
   // First queued buffer is the active request.
   acquire(&idelock);
@@ -112,20 +339,61 @@ ideintr(void)
     release(&idelock);
     return;
   }
+  write = b->flags & B_DIRTY;
+
+  if(idebm){
+    // Stop the bus master and acknowledge the drive.
+    st = inb(idebm + BM_STATUS);
+    if((st & BM_INTR) == 0){
+      release(&idelock);
+      return;
+    }
+    outb(idebm + BM_CMD, 0);
+    outb(idebm + BM_STATUS, st | BM_INTR | BM_ERR);
+    idewait(1);
+  } else if(write){
+    // Move the next DRQ block of data. The command is
+    // done once the whole chain has been transferred.
+    if(idenext){
+      idepio(1);
+      idecharge(write, t0);
+      release(&idelock);
+      return;
+    }
+  } else if(idewait(1) >= 0){
+    idepio(0);
+    if(idenext){
+      idecharge(write, t0);
+      release(&idelock);
+      return;
+    }
+  }
+  idenext = 0;
   idequeue = b->qnext;
+  idestat.svcticks += ticks - idestartticks;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  // Wake processes waiting for these bufs, or finish
+  // an asynchronous read for the process that started it.
+  for(; b; b = c){
+    c = b->mnext;
+    b->mnext = 0;
+    idepos = b->blockno + 1;
+    idestat.depth--;
+    idestat.waitticks += ticks - b->qtime;
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if(b->flags & B_ASYNC){
+      b->flags &= ~B_ASYNC;
+      basyncdone(b);
+    } else
+      wakeup(b);
+  }
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  idecharge(write, t0);
 
   // Start disk on next buf in queue.
   if(idequeue != 0)
-    idestart(idequeue);
+    idestart(idepick());
 
   release(&idelock);
 }
@@ -137,8 +405,6 @@ ideintr(void)
 void
 iderw(struct buf *b)
 {
-  struct buf **pp;
-
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
@@ -148,21 +414,73 @@ iderw(struct buf *b)
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
+  ideenqueue(b);
 
   // Start disk if necessary.
   if(idequeue == b)
     idestart(b);
 
-  // Wait for request to finish.
-  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
-    sleep(b, &idelock);
+  // Wait for request to finish. ideintr releases
+  // asynchronous reads itself.
+  if((b->flags & B_ASYNC) == 0){
+    while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
+      sleep(b, &idelock);
+    }
   }
 
 
   release(&idelock);
 }
+
+// Sync n bufs with disk, as iderw does, and wait for all.
+// They are queued together so that neighbouring blocks go out
+// in one disk command. Either all or none are asynchronous
+// reads, which ideintr releases without waiting for.
+void
+iderwv(struct buf **bp, int n)
+{
+  int i, idle, async;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bp[i]->lock))
+      panic("iderwv: buf not locked");
+    if((bp[i]->flags & (B_VALID|B_DIRTY)) == B_VALID)
+      panic("iderwv: nothing to do");
+    if((bp[i]->flags & B_ASYNC) != (bp[0]->flags & B_ASYNC))
+      panic("iderwv: mixed async");
+    if(bp[i]->dev != 0 && !havedisk1)
+      panic("iderwv: ide disk 1 not present");
+  }
+  if(n == 0)
+    return;
+  async = bp[0]->flags & B_ASYNC;
+
+  acquire(&idelock);
+
+  idle = idequeue == 0;
+  for(i = 0; i < n; i++)
+    ideenqueue(bp[i]);
+  if(idle)
+    idestart(idepick());
+
+  if(!async){
+    for(i = 0; i < n; i++)
+      while((bp[i]->flags & (B_VALID|B_DIRTY)) != B_VALID)
+        sleep(bp[i], &idelock);
+  }
+
+  release(&idelock);
+}
+
+// Copy out the disk queue statistics.
+void
+idestats(struct dstat *st)
+{
+  acquire(&idelock);
+  *st = idestat;
+  st->bsize = bsize;
+  st->dma = idebm != 0;
+  st->rkcycles = idecycles[0] >> 10;
+  st->wkcycles = idecycles[1] >> 10;
+  release(&idelock);
+}
@@ -73,3 +73,12 @@ ioapicenable(int irq, int cpunum)
   ioapicwrite(REG_TABLE+2*irq, T_IRQ0 + irq);
   ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
 }
+
+// Like ioapicenable, but deliver irq as interrupt vector vec.
+// For PCI devices, whose irq is chosen by the BIOS.
+void
+ioapicroute(int irq, int vec, int cpunum)
+{
+  ioapicwrite(REG_TABLE+2*irq, vec);
+  ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
+}
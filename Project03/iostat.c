@@ -0,0 +1,43 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "dstat.h"
+
+// Driver CPU time in kilocycles per MB moved.
+uint
+permb(uint kcycles, uint nblock, uint bsize)
+{
+  uint bpm = 1024*1024 / bsize;
+
+  if(nblock == 0)
+    return 0;
+  return kcycles / nblock * bpm + kcycles % nblock * bpm / nblock;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct dstat st;
+
+  if(dstat(&st) < 0){
+    printf(2, "iostat: failed\n");
+    exit();
+  }
+  printf(1, "requests %d commands %d read %d written %d (%d-byte blocks)\n",
+         st.nreq, st.ncmd, st.nread, st.nwrite, st.bsize);
+  printf(1, "depth %d max %d", st.depth, st.maxdepth);
+  if(st.nreq > 0)
+    printf(1, " avg %d.%d", st.sumdepth / st.nreq,
+           st.sumdepth * 10 / st.nreq % 10);
+  printf(1, "\n");
+  printf(1, "service %d ticks wait %d ticks", st.svcticks, st.waitticks);
+  if(st.ncmd > 0)
+    printf(1, " avg service %d ticks", st.svcticks / st.ncmd);
+  if(st.nreq > 0)
+    printf(1, " avg wait %d ticks", st.waitticks / st.nreq);
+  printf(1, "\nwrite deadlines %d\n", st.ndeadline);
+  printf(1, "%s: read %d kcycles/MB write %d kcycles/MB\n",
+         st.dma ? "dma" : "pio", permb(st.rkcycles, st.nread, st.bsize),
+         permb(st.wkcycles, st.nwrite, st.bsize));
+  exit();
+}
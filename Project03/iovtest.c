@@ -0,0 +1,157 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "uio.h"
+
+// pread/pwrite and readv/writev test.
+// Threads sharing one descriptor each pwrite and pread their own
+// region, then small records are written one write() at a time
+// and NIOV at a time with writev(), and read back with readv().
+
+#define NUM_THREAD 4
+#define REGION 2048
+#define RECSZ 16
+#define NUM_REC 1024
+
+int fd;
+char bufs[NUM_THREAD][REGION];
+char rec[NIOV][RECSZ];
+
+void failed()
+{
+  printf(1, "Test failed!\n");
+  unlink("iovtest.tmp");
+  exit();
+}
+
+void *thread_main(void *arg)
+{
+  int val = (int)arg;
+  int i;
+
+  memset(bufs[val], 'a' + val, REGION);
+  if (pwrite(fd, bufs[val], REGION, val * REGION) != REGION)
+    thread_exit((void *)-1);
+  memset(bufs[val], 0, REGION);
+  if (pread(fd, bufs[val], REGION, val * REGION) != REGION)
+    thread_exit((void *)-1);
+  for (i = 0; i < REGION; i++)
+    if (bufs[val][i] != 'a' + val)
+      thread_exit((void *)-1);
+  thread_exit(arg);
+  return 0;
+}
+
+void threads(void)
+{
+  thread_t tids[NUM_THREAD];
+  struct stat st;
+  void *retval;
+  int i;
+
+  for (i = 0; i < NUM_THREAD; i++) {
+    if (thread_create(&tids[i], thread_main, (void *)i) != 0) {
+      printf(1, "Error creating thread %d\n", i);
+      failed();
+    }
+  }
+  for (i = 0; i < NUM_THREAD; i++) {
+    if (thread_join(tids[i], &retval) != 0 || (int)retval != i) {
+      printf(1, "Thread %d: pread/pwrite mismatch\n", i);
+      failed();
+    }
+  }
+  if (fstat(fd, &st) < 0 || st.size != NUM_THREAD * REGION) {
+    printf(1, "Wrong size after pwrite\n");
+    failed();
+  }
+  // pwrite must not have moved the shared offset.
+  if (read(fd, bufs[0], 1) != 1 || bufs[0][0] != 'a') {
+    printf(1, "pwrite moved the file offset\n");
+    failed();
+  }
+  printf(1, "pread/pwrite: ok\n");
+}
+
+void fill(int n)
+{
+  int i;
+
+  for (i = 0; i < NIOV; i++) {
+    memset(rec[i], 0, RECSZ);
+    ((int *)rec[i])[0] = n + i;
+  }
+}
+
+int records(int vector)
+{
+  struct iovec iov[NIOV];
+  int i, j, start;
+
+  if ((fd = open("iovtest.tmp", O_CREATE | O_RDWR)) < 0)
+    failed();
+  for (i = 0; i < NIOV; i++) {
+    iov[i].base = rec[i];
+    iov[i].len = RECSZ;
+  }
+
+  start = uptime();
+  for (i = 0; i < NUM_REC; i += NIOV) {
+    fill(i);
+    if (vector) {
+      if (writev(fd, iov, NIOV) != NIOV * RECSZ)
+        failed();
+    } else {
+      for (j = 0; j < NIOV; j++)
+        if (write(fd, rec[j], RECSZ) != RECSZ)
+          failed();
+    }
+  }
+  start = uptime() - start;
+  close(fd);
+
+  if ((fd = open("iovtest.tmp", O_RDONLY)) < 0)
+    failed();
+  for (i = 0; i < NUM_REC; i += NIOV) {
+    if (readv(fd, iov, NIOV) != NIOV * RECSZ)
+      failed();
+    for (j = 0; j < NIOV; j++) {
+      if (((int *)rec[j])[0] != i + j) {
+        printf(1, "Record %d is wrong\n", i + j);
+        failed();
+      }
+    }
+  }
+  if (readv(fd, iov, NIOV) != 0)
+    failed();
+  close(fd);
+  unlink("iovtest.tmp");
+  return start;
+}
+
+int main(int argc, char *argv[])
+{
+  int i;
+
+  printf(1, "Vector I/O test\n");
+  // Writes may not leave holes, so give the threads a file
+  // of the final size to pwrite into.
+  if ((fd = open("iovtest.tmp", O_CREATE | O_RDWR)) < 0)
+    failed();
+  for (i = 0; i < NUM_THREAD; i++)
+    if (write(fd, bufs[i], REGION) != REGION)
+      failed();
+  close(fd);
+  if ((fd = open("iovtest.tmp", O_RDWR)) < 0)
+    failed();
+  threads();
+  close(fd);
+  unlink("iovtest.tmp");
+
+  printf(1, "%d records of %d bytes: write %d ticks", NUM_REC, RECSZ,
+         records(0));
+  printf(1, ", writev %d ticks\n", records(1));
+  printf(1, "All tests passed!\n");
+  exit();
+}
@@ -21,6 +21,7 @@ struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  int nfree;
 } kmem;
 
 // Initialization happens in two phases.
@@ -72,25 +73,50 @@ kfree(char *v)
   r = (struct run*)v;
   r->next = kmem.freelist;
   kmem.freelist = r;
+  kmem.nfree++;
   if(kmem.use_lock)
     release(&kmem.lock);
 }
 
-// Allocate one 4096-byte page of physical memory.
-// Returns a pointer that the kernel can use.
+// Allocate one 4096-byte page of physical memory
+// without reclaiming anything. For the buffer cache,
+// which must not recurse into breclaim().
 // Returns 0 if the memory cannot be allocated.
 char*
-kalloc(void)
+kalloctry(void)
 {
   struct run *r;
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
   r = kmem.freelist;
-  if(r)
+  if(r){
     kmem.freelist = r->next;
+    kmem.nfree--;
+  }
   if(kmem.use_lock)
     release(&kmem.lock);
   return (char*)r;
 }
 
+// Allocate one 4096-byte page of physical memory.
+// Returns a pointer that the kernel can use.
+// If memory is short, shrink the buffer cache first.
+// Returns 0 if the memory cannot be allocated.
+char*
+kalloc(void)
+{
+  char *r;
+
+  if((r = kalloctry()) == 0 && breclaim(1) > 0)
+    r = kalloctry();
+  return r;
+}
+
+// Number of free pages, as a hint for sizing caches.
+int
+kfreecount(void)
+{
+  return kmem.nfree;
+}
+
@@ -1,6 +1,8 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
@@ -18,7 +20,16 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// asks for a commit and sleeps until one has happened.
+// Each call reserves the most blocks it may add to the log,
+// MAXOPBLOCKS unless it knows better (begin_opn()), and
+// hands back at end_op() whatever it did not add; writing
+// a block that is already in the log costs nothing.
+//
+// Commits are done by a kernel process, logflusher, every
+// FLUSHTICKS ticks or sooner when the log fills up or fsync()
+// asks, so end_op() never writes to the disk itself and
+// several calls' updates go out in one commit.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -40,8 +51,13 @@ struct log {
   struct spinlock lock;
   int start;
   int size;
+  int cap;         // data blocks usable in this log.
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    // blocks they may still add.
   int committing;  // in commit(), please wait.
+  int flushreq;    // someone wants a commit soon.
+  uint ncommit;    // commits completed, for fsync.
+  uint lastcommit; // ticks at the last commit.
   int dev;
   struct logheader lh;
 };
@@ -49,11 +65,12 @@ struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void logflusher(void);
 
 void
 initlog(int dev)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) >= MINBSIZE)
     panic("initlog: too big logheader");
 
   struct superblock sb;
@@ -61,23 +78,52 @@ initlog(int dev)
   readsb(dev, &sb);
   log.start = sb.logstart;
   log.size = sb.nlog;
+  log.cap = log.size - 1;
+  if(log.cap > LOGSIZE)
+    log.cap = LOGSIZE;
+  if(log.cap < MAXOPBLOCKS)
+    panic("initlog: log too small");
   log.dev = dev;
   recover_from_log();
+
+  if(kthread("logflush", logflusher) < 0)
+    panic("initlog: no flusher");
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location.
+// After a crash the data is in the log blocks; during a commit
+// the cached home blocks still hold it. Home blocks are written
+// in block order so that runs of neighbours share a request.
 static void
-install_trans(void)
+install_trans(int recovering)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+  struct buf *bp[LOGBATCH];
+  int order[LOGSIZE];
+  int i, j, n, tail;
+
+  // Sort log slots by home block number.
+  for (i = 0; i < log.lh.n; i++) {
+    for (j = i; j > 0 && log.lh.block[order[j-1]] > log.lh.block[i]; j--)
+      order[j] = order[j-1];
+    order[j] = i;
+  }
+
+  for (i = 0; i < log.lh.n; i += n) {
+    n = 0;
+    do {
+      tail = order[i+n];
+      bp[n] = bread(log.dev, log.lh.block[tail]); // read dst
+      if (recovering) {
+        struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
+        memmove(bp[n]->data, lbuf->data, bsize);  // copy block to dst
+        brelse(lbuf);
+      }
+      n++;
+    } while (n < LOGBATCH && i+n < log.lh.n &&
+             log.lh.block[order[i+n]] == log.lh.block[order[i+n-1]] + 1);
+    bwritev(bp, n);  // write dst to disk
+    for (j = 0; j < n; j++)
+      brelse(bp[j]);
   }
 }
 
@@ -116,76 +162,138 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(); // if committed, copy from log to disk
+  install_trans(1); // if committed, copy from log to disk
   log.lh.n = 0;
   write_head(); // clear the log
 }
 
-// called at the start of each FS system call.
+// called at the start of each FS system call that adds
+// at most n blocks to the log.
 void
-begin_op(void)
+begin_opn(int n)
 {
+  if(n > log.cap)
+    panic("begin_opn");
   acquire(&log.lock);
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + n > log.cap){
       // this op might exhaust log space; wait for commit.
+      log.flushreq = 1;
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      myproc()->logreserve = n;
+      myproc()->logblocks = 0;
       release(&log.lock);
       break;
     }
   }
 }
 
+// called at the start of each FS system call.
+void
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// The flusher commits later; this only gives back
+// the log space the call had reserved.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
-  }
+  log.reserved -= myproc()->logreserve - myproc()->logblocks;
+  // begin_op() may be waiting for log space,
+  // and decrementing log.outstanding has decreased
+  // the amount of reserved space. The flusher may
+  // be waiting for the last call to finish.
+  wakeup(&log);
   release(&log.lock);
+}
+
+// Body of the logflush kernel process. Wakes every tick
+// and commits once FLUSHTICKS have passed since the last
+// commit, or right away if asked to.
+static void
+logflusher(void)
+{
+  for(;;){
+    acquire(&tickslock);
+    sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    acquire(&log.lock);
+    if(log.lh.n == 0 ||
+       (!log.flushreq && ticks - log.lastcommit < FLUSHTICKS)){
+      release(&log.lock);
+      continue;
+    }
+    // Keep new calls out and wait for running ones.
+    log.committing = 1;
+    while(log.outstanding > 0)
+      sleep(&log, &log.lock);
+    release(&log.lock);
 
-  if(do_commit){
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
+
     acquire(&log.lock);
     log.committing = 0;
+    log.flushreq = 0;
+    log.ncommit++;
+    log.lastcommit = ticks;
     wakeup(&log);
     release(&log.lock);
   }
 }
 
+// Wait until every FS system call that has already
+// finished is on disk. Must not be called inside a
+// transaction.
+void
+log_sync(void)
+{
+  uint n;
+
+  acquire(&log.lock);
+  // A commit in progress covers every finished call, and
+  // so does the next one if there is anything to commit.
+  if(log.committing || log.lh.n > 0){
+    n = log.ncommit;
+    log.flushreq = 1;
+    while(log.ncommit == n)
+      sleep(&log, &log.lock);
+  }
+  release(&log.lock);
+}
+
 // Copy modified blocks from cache to log.
 static void
 write_log(void)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  struct buf *to[LOGBATCH];
+  int tail, n, i;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if (n > LOGBATCH)
+      n = LOGBATCH;
+    for (i = 0; i < n; i++) {
+      to[i] = bread(log.dev, log.start+tail+i+1); // log block
+      struct buf *from = bread(log.dev, log.lh.block[tail+i]); // cache block
+      memmove(to[i]->data, from->data, bsize);
+      brelse(from);
+    }
+    bwritev(to, n);  // write the log
+    for (i = 0; i < n; i++)
+      brelse(to[i]);
   }
 }
 
@@ -195,7 +303,7 @@ commit()
   if (log.lh.n > 0) {
     write_log();     // Write modified blocks from cache to log
     write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
+    install_trans(0); // Now install writes to home locations
     log.lh.n = 0;
     write_head();    // Erase the transaction from the log
   }
@@ -215,8 +323,6 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
-    panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
@@ -226,8 +332,13 @@ log_write(struct buf *b)
       break;
   }
   log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
+  if (i == log.lh.n) {
+    // A new block moves from the op's reservation into the log.
+    if (++myproc()->logblocks > myproc()->logreserve)
+      panic("too big a transaction");
     log.lh.n++;
+    log.reserved--;
+  }
   b->flags |= B_DIRTY; // prevent eviction
   release(&log.lock);
 }
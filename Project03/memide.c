@@ -12,17 +12,18 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "dstat.h"
 
-extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
+extern uchar _binary_memfs_img_start[], _binary_memfs_img_size[];
 
-static int disksize;
+static uint disksize;  // bytes
 static uchar *memdisk;
 
 void
 ideinit(void)
 {
-  memdisk = _binary_fs_img_start;
-  disksize = (uint)_binary_fs_img_size/BSIZE;
+  memdisk = _binary_memfs_img_start;
+  disksize = (uint)_binary_memfs_img_size;
 }
 
 // Interrupt handler.
@@ -46,15 +47,35 @@ iderw(struct buf *b)
     panic("iderw: nothing to do");
   if(b->dev != 1)
     panic("iderw: request not for disk 1");
-  if(b->blockno >= disksize)
+  if((b->blockno+1)*bsize > disksize)
     panic("iderw: block out of range");
 
-  p = memdisk + b->blockno*BSIZE;
+  p = memdisk + b->blockno*bsize;
 
   if(b->flags & B_DIRTY){
     b->flags &= ~B_DIRTY;
-    memmove(p, b->data, BSIZE);
+    memmove(p, b->data, bsize);
   } else
-    memmove(b->data, p, BSIZE);
+    memmove(b->data, p, bsize);
   b->flags |= B_VALID;
+  if(b->flags & B_ASYNC){
+    b->flags &= ~B_ASYNC;
+    basyncdone(b);
+  }
+}
+
+void
+iderwv(struct buf **bp, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    iderw(bp[i]);
+}
+
+void
+idestats(struct dstat *st)
+{
+  memset(st, 0, sizeof(*st));
+  st->bsize = bsize;
 }
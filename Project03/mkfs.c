@@ -15,20 +15,25 @@
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define NINODES 200
+#define NINODES 200  // default number of inodes
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
-
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
-int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+// With blocks larger than a sector, the super block is in block 0.
+
+uint bsize = MINBSIZE;
+uint fsflags;  // SB_*
+uint ninodes = NINODES;
+uint fssize = FSSIZE;
+int nbitmap;
+int ninodeblocks;
+int nlog = LOGSIZE+1;  // header and LOGSIZE blocks
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
 struct superblock sb;
-char zeroes[BSIZE];
+char zeroes[MAXBSIZE];
 uint freeinode = 1;
 uint freeblock;
 
@@ -40,6 +45,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+int dxdir(uint inum);
 
 // convert to intel byte order
 ushort
@@ -70,19 +76,58 @@ main(int argc, char *argv[])
   int i, cc, fd;
   uint rootino, inum, off;
   struct dirent de;
-  char buf[BSIZE];
+  char buf[MAXBSIZE];
   struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  while(argc > 2 && argv[1][0] == '-'){
+    if(strcmp(argv[1], "-e") == 0 || strcmp(argv[1], "-d") == 0){
+      fsflags |= argv[1][1] == 'e' ? SB_EXTENT : SB_DXDIR;
+      argc--;
+      argv++;
+      continue;
+    }
+    if(strcmp(argv[1], "-l") == 0){
+      nlog = atoi(argv[2]);
+      if(nlog < MAXOPBLOCKS+1 || nlog > LOGSIZE+1){
+        fprintf(stderr, "mkfs: log must be %d to %d blocks\n",
+                MAXOPBLOCKS+1, LOGSIZE+1);
+        exit(1);
+      }
+    } else if(strcmp(argv[1], "-b") == 0){
+      bsize = atoi(argv[2]);
+      if(bsize < MINBSIZE || bsize > MAXBSIZE || (bsize & (bsize-1)) != 0){
+        fprintf(stderr, "mkfs: block size must be a power of 2 from %d to %d\n",
+                MINBSIZE, MAXBSIZE);
+        exit(1);
+      }
+    } else if(strcmp(argv[1], "-s") == 0){
+      fssize = atoi(argv[2]);
+      if(fssize < 64){
+        fprintf(stderr, "mkfs: size must be at least 64 blocks\n");
+        exit(1);
+      }
+    } else if(strcmp(argv[1], "-i") == 0){
+      ninodes = atoi(argv[2]);
+      if(ninodes < 2 || ninodes > 65535){
+        fprintf(stderr, "mkfs: inodes must be 2 to 65535\n");
+        exit(1);
+      }
+    } else
+      break;
+    argc -= 2;
+    argv += 2;
+  }
+
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-e] [-d] [-l nlog] [-b bsize] [-s nblocks] [-i ninodes] fs.img files...\n");
     exit(1);
   }
 
-  assert((BSIZE % sizeof(struct dinode)) == 0);
-  assert((BSIZE % sizeof(struct dirent)) == 0);
+  assert((bsize % sizeof(struct dinode)) == 0);
+  assert((bsize % sizeof(struct dirent)) == 0);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
@@ -90,29 +135,35 @@ main(int argc, char *argv[])
     exit(1);
   }
 
-  // 1 fs block = 1 disk sector
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
+  // The log starts in the block after the super block.
+  nbitmap = fssize/BPB(bsize) + 1;
+  ninodeblocks = ninodes / IPB(bsize) + 1;
+  nmeta = SBOFF/bsize + 1 + nlog + ninodeblocks + nbitmap;
+  nblocks = fssize - nmeta;
 
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
-  sb.logstart = xint(2);
-  sb.inodestart = xint(2+nlog);
-  sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.logstart = xint(SBOFF/bsize + 1);
+  sb.inodestart = xint(SBOFF/bsize + 1 + nlog);
+  sb.bmapstart = xint(SBOFF/bsize + 1 + nlog + ninodeblocks);
+  sb.bsize = xint(bsize);
+  sb.flags = xint(fsflags);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d bsize %d%s%s\n",
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, fssize, bsize,
+         (fsflags & SB_EXTENT) ? " extents" : "",
+         (fsflags & SB_DXDIR) ? " hashed-dirs" : "");
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
+  for(i = 0; i < fssize; i++)
     wsect(i, zeroes);
 
   memset(buf, 0, sizeof(buf));
-  memmove(buf, &sb, sizeof(sb));
-  wsect(1, buf);
+  memmove(buf + SBOFF%bsize, &sb, sizeof(sb));
+  wsect(SBOFF/bsize, buf);
 
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
@@ -156,11 +207,13 @@ main(int argc, char *argv[])
   }
 
   // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  if((fsflags & SB_DXDIR) == 0 || dxdir(rootino) < 0){
+    rinode(rootino, &din);
+    off = xint(din.size);
+    off = ((off/bsize) + 1) * bsize;
+    din.size = xint(off);
+    winode(rootino, &din);
+  }
 
   balloc(freeblock);
 
@@ -170,11 +223,11 @@ main(int argc, char *argv[])
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
+  if(lseek(fsfd, sec * bsize, 0) != sec * bsize){
     perror("lseek");
     exit(1);
   }
-  if(write(fsfd, buf, BSIZE) != BSIZE){
+  if(write(fsfd, buf, bsize) != bsize){
     perror("write");
     exit(1);
   }
@@ -183,13 +236,13 @@ wsect(uint sec, void *buf)
 void
 winode(uint inum, struct dinode *ip)
 {
-  char buf[BSIZE];
+  char buf[MAXBSIZE];
   uint bn;
   struct dinode *dip;
 
   bn = IBLOCK(inum, sb);
   rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
+  dip = ((struct dinode*)buf) + (inum % IPB(bsize));
   *dip = *ip;
   wsect(bn, buf);
 }
@@ -197,24 +250,24 @@ winode(uint inum, struct dinode *ip)
 void
 rinode(uint inum, struct dinode *ip)
 {
-  char buf[BSIZE];
+  char buf[MAXBSIZE];
   uint bn;
   struct dinode *dip;
 
   bn = IBLOCK(inum, sb);
   rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
+  dip = ((struct dinode*)buf) + (inum % IPB(bsize));
   *ip = *dip;
 }
 
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
+  if(lseek(fsfd, sec * bsize, 0) != sec * bsize){
     perror("lseek");
     exit(1);
   }
-  if(read(fsfd, buf, BSIZE) != BSIZE){
+  if(read(fsfd, buf, bsize) != bsize){
     perror("read");
     exit(1);
   }
@@ -237,12 +290,12 @@ ialloc(ushort type)
 void
 balloc(int used)
 {
-  uchar buf[BSIZE];
+  uchar buf[MAXBSIZE];
   int i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
+  assert(used < BPB(bsize));
+  bzero(buf, bsize);
   for(i = 0; i < used; i++){
     buf[i/8] = buf[i/8] | (0x1 << (i%8));
   }
@@ -252,41 +305,108 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// bmap for an extent-mapped file system (-e). Blocks are handed
+// out in order, so a new block usually lengthens the last extent.
+uint
+xmap(struct dinode *din, uint fbn)
+{
+  struct extent x[NEXTENT + NXEXTENT(MAXBSIZE)];
+  uint i, lbn, addr;
+
+  memset(x, 0, sizeof(x));
+  memmove(x, din->addrs, NEXTENT*sizeof(struct extent));
+  if(xint(din->addrs[XBLOCK]))
+    rsect(xint(din->addrs[XBLOCK]), x + NEXTENT);
+
+  lbn = 0;
+  for(i = 0; i < NEXTENT + NXEXTENT(bsize) && xint(x[i].len); i++){
+    if(fbn < lbn + xint(x[i].len))
+      return xint(x[i].start) + fbn - lbn;
+    lbn += xint(x[i].len);
+  }
+  assert(fbn == lbn);
+
+  addr = freeblock++;
+  if(i > 0 && xint(x[i-1].start) + xint(x[i-1].len) == addr){
+    i--;
+    x[i].len = xint(xint(x[i].len) + 1);
+  } else {
+    assert(i < NEXTENT + NXEXTENT(bsize));
+    if(i == NEXTENT){
+      din->addrs[XBLOCK] = xint(addr);
+      addr = freeblock++;
+    }
+    x[i].start = xint(addr);
+    x[i].len = xint(1);
+  }
+  if(i < NEXTENT)
+    memmove(din->addrs, x, NEXTENT*sizeof(struct extent));
+  else
+    wsect(xint(din->addrs[XBLOCK]), x + NEXTENT);
+  return addr;
+}
+
+// Return the block holding block fbn of din, allocating
+// it and any indirect blocks on the way.
+uint
+bmap(struct dinode *din, uint fbn)
+{
+  uint indirect[NINDIRECT(MAXBSIZE)];
+  uint addr, nind, span, i;
+  int level;
+
+  if(fsflags & SB_EXTENT)
+    return xmap(din, fbn);
+
+  assert(fbn < MAXFILE(bsize));
+  if(fbn < NDIRECT){
+    if(xint(din->addrs[fbn]) == 0)
+      din->addrs[fbn] = xint(freeblock++);
+    return xint(din->addrs[fbn]);
+  }
+  fbn -= NDIRECT;
+
+  nind = NINDIRECT(bsize);
+  span = nind;
+  for(level = 1; fbn >= span; level++){
+    fbn -= span;
+    span *= nind;
+  }
+  if(xint(din->addrs[NDIRECT+level-1]) == 0)
+    din->addrs[NDIRECT+level-1] = xint(freeblock++);
+  addr = xint(din->addrs[NDIRECT+level-1]);
+  for(; level > 0; level--){
+    span /= nind;
+    rsect(addr, (char*)indirect);
+    i = fbn / span;
+    if(indirect[i] == 0){
+      indirect[i] = xint(freeblock++);
+      wsect(addr, (char*)indirect);
+    }
+    addr = xint(indirect[i]);
+    fbn %= span;
+  }
+  return addr;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
   uint fbn, off, n1;
   struct dinode din;
-  char buf[BSIZE];
-  uint indirect[NINDIRECT];
+  char buf[MAXBSIZE];
   uint x;
 
   rinode(inum, &din);
   off = xint(din.size);
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
   while(n > 0){
-    fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
-    n1 = min(n, (fbn + 1) * BSIZE - off);
+    fbn = off / bsize;
+    x = bmap(&din, fbn);
+    n1 = min(n, (fbn + 1) * bsize - off);
     rsect(x, buf);
-    bcopy(p, buf + off - (fbn * BSIZE), n1);
+    bcopy(p, buf + off - (fbn * bsize), n1);
     wsect(x, buf);
     n -= n1;
     off += n1;
@@ -295,3 +415,87 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Must match dxhash in fs.c.
+uint
+dxhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// Rewrite directory inum as a hashed directory (see fs.h) if it
+// has outgrown one block, with the fewest buckets that hold its
+// entries. Return -1 if it was left as it was.
+int
+dxdir(uint inum)
+{
+  struct dinode din;
+  struct dirent *de, *bde;
+  struct dxslot *h;
+  ushort *t;
+  char *blk;
+  uint n, i, k, depth, size, *cnt;
+
+  rinode(inum, &din);
+  size = xint(din.size);
+  if(size <= bsize)
+    return -1;
+  n = size / sizeof(struct dirent);
+  de = calloc(1, (size/bsize + 1) * bsize);
+  for(i = 0; i * bsize < size; i++)
+    rsect(bmap(&din, i), (char*)de + i*bsize);
+
+  for(depth = 1; ; depth++){
+    if((1 << depth) > DXTABLE(bsize)){
+      free(de);
+      return -1;
+    }
+    cnt = calloc(1 << depth, sizeof(uint));
+    for(i = 0; i < n; i++)
+      if(de[i].inum)
+        cnt[dxhash(de[i].name) & ((1 << depth) - 1)]++;
+    for(k = 0; k < (1 << depth); k++)
+      if(cnt[k] > DXENTRIES(bsize))
+        break;
+    free(cnt);
+    if(k == (1 << depth))
+      break;
+  }
+
+  // Block 0 is the index, block 1+k bucket k.
+  blk = calloc(1 + (1 << depth), bsize);
+  h = (struct dxslot*)blk;
+  h->v[0] = xshort(DXMAGIC);
+  h->v[1] = xshort(depth);
+  t = (ushort*)blk;
+  for(k = 0; k < (1 << depth); k++){
+    t[(1 + k/7) * 8 + 1 + k%7] = xshort(1 + k);
+    h = (struct dxslot*)(blk + (1 + k)*bsize);
+    h->v[0] = xshort(DXMAGIC);
+    h->v[1] = xshort(depth);
+  }
+  cnt = calloc(1 << depth, sizeof(uint));
+  for(i = 0; i < n; i++){
+    if(de[i].inum){
+      k = dxhash(de[i].name) & ((1 << depth) - 1);
+      bde = (struct dirent*)(blk + (1 + k)*bsize);
+      bde[1 + cnt[k]++] = de[i];
+    }
+  }
+
+  din.size = xint(0);
+  winode(inum, &din);
+  iappend(inum, blk, (1 + (1 << depth)) * bsize);
+  free(cnt);
+  free(blk);
+  free(de);
+  return 0;
+}
@@ -0,0 +1,174 @@
+//
+// Address spaces shared by the threads of a process.
+//
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "mm.h"
+
+struct {
+  struct spinlock lock;
+  struct mm mm[NPROC];
+} mmtable;
+
+void
+mminit(void)
+{
+  initlock(&mmtable.lock, "mmtable");
+}
+
+// Allocate an mm owning pgdir, with a reference count of 1.
+// Returns 0 if none are free.
+struct mm*
+mmalloc(pde_t *pgdir, uint sz)
+{
+  struct mm *mm;
+
+  acquire(&mmtable.lock);
+  for(mm = mmtable.mm; mm < mmtable.mm + NPROC; mm++){
+    if(mm->ref == 0){
+      mm->ref = 1;
+      release(&mmtable.lock);
+      initlock(&mm->lock, "mm");
+      mm->pgdir = pgdir;
+      mm->sz = sz;
+      memset(mm->vma, 0, sizeof(mm->vma));
+      return mm;
+    }
+  }
+  release(&mmtable.lock);
+  return 0;
+}
+
+// Increment ref count for mm.
+struct mm*
+mmdup(struct mm *mm)
+{
+  acquire(&mmtable.lock);
+  if(mm->ref < 1)
+    panic("mmdup");
+  mm->ref++;
+  release(&mmtable.lock);
+  return mm;
+}
+
+// Drop a reference to mm; the last one frees the page table.
+void
+mmput(struct mm *mm)
+{
+  pde_t *pgdir;
+
+  acquire(&mmtable.lock);
+  if(mm->ref < 1)
+    panic("mmput");
+  if(--mm->ref > 0){
+    release(&mmtable.lock);
+    return;
+  }
+  pgdir = mm->pgdir;
+  mm->pgdir = 0;
+  mm->sz = 0;
+  release(&mmtable.lock);
+
+  freevm(pgdir);
+}
+
+// Grow mm by n bytes.
+// Return the old size on success, -1 on failure.
+int
+mmgrow(struct mm *mm, int n)
+{
+  uint oldsz, sz;
+  struct vma *v;
+
+  acquire(&mm->lock);
+  oldsz = sz = mm->sz;
+  if(n > 0){
+    if((sz = allocuvm(mm->pgdir, sz, sz + n)) == 0){
+      release(&mm->lock);
+      return -1;
+    }
+  } else if(n < 0){
+    if((sz = deallocuvm(mm->pgdir, sz, sz + n)) == 0){
+      release(&mm->lock);
+      return -1;
+    }
+    // Forget stacks that are no longer mapped.
+    for(v = mm->vma; v < mm->vma + NVMA; v++)
+      if(v->end > sz)
+        v->start = v->end = v->used = 0;
+  }
+  mm->sz = sz;
+  release(&mm->lock);
+  return oldsz;
+}
+
+// Find room for a thread stack of two pages, the lower one a guard.
+// Stacks released by earlier threads are reused before growing mm.
+// Returns the base of the region, or 0 on failure.
+uint
+mmstackalloc(struct mm *mm)
+{
+  struct vma *v, *free;
+  uint sz;
+
+  acquire(&mm->lock);
+  free = 0;
+  for(v = mm->vma; v < mm->vma + NVMA; v++){
+    if(v->end != 0 && !v->used){
+      v->used = 1;
+      release(&mm->lock);
+      return v->start;
+    }
+    if(v->end == 0 && free == 0)
+      free = v;
+  }
+  if(free == 0){
+    release(&mm->lock);
+    return 0;
+  }
+
+  sz = PGROUNDUP(mm->sz);
+  if((sz = allocuvm(mm->pgdir, sz, sz + 2*PGSIZE)) == 0){
+    release(&mm->lock);
+    return 0;
+  }
+  clearpteu(mm->pgdir, (char*)(sz - 2*PGSIZE));
+  mm->sz = sz;
+  free->start = sz - 2*PGSIZE;
+  free->end = sz;
+  free->used = 1;
+  release(&mm->lock);
+  return free->start;
+}
+
+// Mark the thread stack at base as free for reuse.
+void
+mmstackfree(struct mm *mm, uint base)
+{
+  struct vma *v;
+
+  acquire(&mm->lock);
+  for(v = mm->vma; v < mm->vma + NVMA; v++)
+    if(v->end != 0 && v->start == base)
+      v->used = 0;
+  release(&mm->lock);
+}
+
+// Copy the stack layout of src into the freshly forked dst. Only the
+// stack of the forking thread, at base, stays in use in the child.
+void
+mmcopystacks(struct mm *dst, struct mm *src, uint base)
+{
+  struct vma *v;
+
+  acquire(&src->lock);
+  memmove(dst->vma, src->vma, sizeof(dst->vma));
+  release(&src->lock);
+  for(v = dst->vma; v < dst->vma + NVMA; v++)
+    v->used = v->end != 0 && v->start == base;
+}
@@ -0,0 +1,16 @@
+// A region of user address space tracked by its mm.
+// Only thread stacks are recorded for now.
+struct vma {
+  uint start;        // Lowest address; its first page is a guard
+  uint end;          // One past the highest address
+  int used;          // Owned by a live thread?
+};
+
+// Address space shared by all threads of a process.
+struct mm {
+  struct spinlock lock; // protects sz and vma
+  int ref;              // Number of procs using it (mmtable.lock)
+  pde_t *pgdir;         // Page table
+  uint sz;              // Size of process memory (bytes)
+  struct vma vma[NVMA]; // Thread stacks carved out of the heap
+};
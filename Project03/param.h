@@ -3,12 +3,22 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // i-nodes cached at boot
+#define NINODEMAX  4096  // max i-nodes the cache grows to
+#define NDCACHE     128  // name cache entries
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define MAXOPBLOCKS  16  // max # of blocks any FS op writes
+#define DIROPBLOCKS  12  // max # of blocks link, create and mkdir write
+#define LOGSIZE      126  // max data blocks in on-disk log; header fills a block
+#define LOGBATCH     16  // max blocks in one multi-block log write
+#define NBUF         (LOGSIZE+MAXOPBLOCKS*3)  // min size of disk block cache
+#define NBUFMAX      8192  // max size of disk block cache
+#define BCACHEFRAC   16  // block cache takes 1/BCACHEFRAC of free memory
+#define READAHEAD    8  // blocks read ahead of a sequential reader
+#define FLUSHTICKS   30  // max ticks a finished FS call waits for commit
+#define IDEDMA       1  // use IDE bus-master DMA if found; 0 forces PIO
 #define FSSIZE       1000  // size of file system in blocks
-
+#define NVMA         NPROC  // max thread stacks per address space
+#define GANGSCHED    1  // co-schedule threads sharing an address space
@@ -0,0 +1,65 @@
+// PCI configuration space access through the I/O ports of
+// configuration mechanism #1.  Only bus 0 is scanned, which is
+// where QEMU's PC machine puts its devices.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+
+#define PCI_ADDR  0xcf8
+#define PCI_DATA  0xcfc
+
+#define PCI_ENABLE  0x80000000
+
+// Config address of bus 0, device dev, function fn.
+static uint
+pcitag(int dev, int fn)
+{
+  return PCI_ENABLE | (dev<<11) | (fn<<8);
+}
+
+// Read the 32-bit config register at byte offset reg.
+uint
+pciread(uint tag, int reg)
+{
+  outl(PCI_ADDR, tag | (reg & 0xfc));
+  return inl(PCI_DATA);
+}
+
+void
+pciwrite(uint tag, int reg, uint val)
+{
+  outl(PCI_ADDR, tag | (reg & 0xfc));
+  outl(PCI_DATA, val);
+}
+
+// Find the first function whose config register reg,
+// masked by mask, equals val.  Return its tag, or 0.
+uint
+pcifind(int reg, uint val, uint mask)
+{
+  int dev, fn, nfn;
+  uint tag;
+
+  for(dev = 0; dev < 32; dev++){
+    nfn = 1;
+    for(fn = 0; fn < nfn; fn++){
+      tag = pcitag(dev, fn);
+      if((pciread(tag, 0x00) & 0xffff) == 0xffff)
+        continue;
+      // Multi-function device.
+      if(fn == 0 && (pciread(tag, 0x0c) & 0x00800000))
+        nfn = 8;
+      if((pciread(tag, reg) & mask) == val)
+        return tag;
+    }
+  }
+  return 0;
+}
+
+// Let the function at tag respond to I/O and master the bus.
+void
+pcienable(uint tag)
+{
+  pciwrite(tag, 0x04, (pciread(tag, 0x04) & 0xffff) | 0x5);
+}
@@ -7,12 +7,20 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
 
-#define PIPESIZE 512
+// The data lives in a ring of whole pages, so that a pipe can be
+// resized with fcntl(F_SETPIPE_SZ), and moves with memmove in runs
+// that stop only at a page boundary. The number of pages is a power
+// of two so that nread and nwrite may wrap around.
+#define PIPEMAXPG 16  // most pages in one pipe
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEMAXPG];
+  uint size;      // bytes in the ring
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
@@ -30,6 +38,10 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(p, 0, sizeof(*p));
+  if((p->page[0] = kalloc()) == 0)
+    goto bad;
+  p->size = PGSIZE;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
@@ -59,6 +71,8 @@ pipealloc(struct file **f0, struct file **f1)
 void
 pipeclose(struct pipe *p, int writable)
 {
+  int i;
+
   acquire(&p->lock);
   if(writable){
     p->writeopen = 0;
@@ -67,13 +81,52 @@ pipeclose(struct pipe *p, int writable)
     p->readopen = 0;
     wakeup(&p->nwrite);
   }
+  pollwakeup();
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
+    for(i = 0; i < p->size/PGSIZE; i++)
+      kfree(p->page[i]);
     kfree((char*)p);
   } else
     release(&p->lock);
 }
 
+// Copy as much of addr[0..n-1] into the ring as fits.
+// Return the number of bytes copied. Caller must hold p->lock.
+static int
+pipein(struct pipe *p, char *addr, int n)
+{
+  uint off, m;
+  int i;
+
+  for(i = 0; i < n && p->nwrite != p->nread + p->size; i += m){
+    off = p->nwrite % p->size;
+    m = min(n - i, p->size - (p->nwrite - p->nread));
+    m = min(m, PGSIZE - off%PGSIZE);
+    memmove(p->page[off/PGSIZE] + off%PGSIZE, addr + i, m);
+    p->nwrite += m;
+  }
+  return i;
+}
+
+// Copy up to n bytes out of the ring to addr.
+// Return the number of bytes copied. Caller must hold p->lock.
+static int
+pipeout(struct pipe *p, char *addr, int n)
+{
+  uint off, m;
+  int i;
+
+  for(i = 0; i < n && p->nread != p->nwrite; i += m){
+    off = p->nread % p->size;
+    m = min(n - i, p->nwrite - p->nread);
+    m = min(m, PGSIZE - off%PGSIZE);
+    memmove(addr + i, p->page[off/PGSIZE] + off%PGSIZE, m);
+    p->nread += m;
+  }
+  return i;
+}
+
 //PAGEBREAK: 40
 int
 pipewrite(struct pipe *p, char *addr, int n)
@@ -81,22 +134,60 @@ pipewrite(struct pipe *p, char *addr, int n)
   int i;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+  for(i = 0; i < n; i += pipein(p, addr + i, n - i)){
+    while(p->nwrite == p->nread + p->size){  //DOC: pipewrite-full
       if(p->readopen == 0 || myproc()->killed){
         release(&p->lock);
         return -1;
       }
       wakeup(&p->nread);
+      pollwakeup();
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
   }
   wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+  pollwakeup();
   release(&p->lock);
   return n;
 }
 
+// Copy up to n bytes into p without sleeping, for callers
+// that hold other locks. Return the number copied, 0 if p is
+// full, or -1 if p has no reader.
+int
+pipeput(struct pipe *p, char *addr, int n)
+{
+  int i;
+
+  acquire(&p->lock);
+  if(p->readopen == 0){
+    release(&p->lock);
+    return -1;
+  }
+  if((i = pipein(p, addr, n)) > 0){
+    wakeup(&p->nread);
+    pollwakeup();
+  }
+  release(&p->lock);
+  return i;
+}
+
+// Wait until p has room for pipeput.
+// Return -1 if p has no reader or we are killed.
+int
+pipewait(struct pipe *p)
+{
+  int r;
+
+  acquire(&p->lock);
+  while(p->nwrite == p->nread + p->size &&
+        p->readopen && !myproc()->killed)
+    sleep(&p->nwrite, &p->lock);
+  r = (p->readopen && !myproc()->killed) ? 0 : -1;
+  release(&p->lock);
+  return r;
+}
+
 int
 piperead(struct pipe *p, char *addr, int n)
 {
@@ -110,12 +201,96 @@ piperead(struct pipe *p, char *addr, int n)
     }
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
-  }
+  i = pipeout(p, addr, n);  //DOC: piperead-copy
   wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  pollwakeup();
   release(&p->lock);
   return i;
 }
+
+// Which of events would not block on p, read through the
+// read end if readable, else the write end.
+int
+pipepoll(struct pipe *p, int readable, int events)
+{
+  int r;
+
+  r = 0;
+  acquire(&p->lock);
+  if(readable){
+    if(p->nread != p->nwrite)
+      r |= POLLIN;
+    if(p->writeopen == 0)
+      r |= POLLIN | POLLHUP;
+  } else {
+    if(p->nwrite != p->nread + p->size)
+      r |= POLLOUT;
+    if(p->readopen == 0)
+      r |= POLLERR;
+  }
+  release(&p->lock);
+  return r & (events | POLLERR | POLLHUP);
+}
+
+//PAGEBREAK!
+// Return the size of p's ring in bytes.
+int
+pipegetsize(struct pipe *p)
+{
+  int n;
+
+  acquire(&p->lock);
+  n = p->size;
+  release(&p->lock);
+  return n;
+}
+
+// Resize p's ring to hold at least n bytes, rounded up to a
+// power-of-two number of pages, moving what the pipe holds to
+// the start of the new ring. Return the new size, or -1 if n
+// is out of range or smaller than what the pipe holds, or if
+// memory is short.
+int
+pipesetsize(struct pipe *p, int n)
+{
+  char *new[PIPEMAXPG], *old[PIPEMAXPG];
+  int i, npg, nold, cnt;
+
+  if(n <= 0 || n > PIPEMAXPG*PGSIZE)
+    return -1;
+  for(npg = 1; npg*PGSIZE < n; npg *= 2)
+    ;
+  for(i = 0; i < npg; i++){
+    if((new[i] = kalloc()) == 0){
+      while(--i >= 0)
+        kfree(new[i]);
+      return -1;
+    }
+  }
+
+  acquire(&p->lock);
+  cnt = p->nwrite - p->nread;
+  if(cnt > npg*PGSIZE){
+    release(&p->lock);
+    for(i = 0; i < npg; i++)
+      kfree(new[i]);
+    return -1;
+  }
+  for(i = 0; i < cnt; i += PGSIZE)
+    pipeout(p, new[i/PGSIZE], min(cnt - i, PGSIZE));
+  nold = p->size/PGSIZE;
+  for(i = 0; i < PIPEMAXPG; i++){
+    old[i] = p->page[i];
+    p->page[i] = i < npg ? new[i] : 0;
+  }
+  p->size = npg*PGSIZE;
+  p->nread = 0;
+  p->nwrite = cnt;
+  wakeup(&p->nwrite);
+  pollwakeup();
+  release(&p->lock);
+
+  for(i = 0; i < nold; i++)
+    kfree(old[i]);
+  return npg*PGSIZE;
+}
@@ -0,0 +1,80 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+// Pipe throughput benchmark: a child reads what the parent
+// writes, first through a pipe of the default size, then
+// through one grown with fcntl(F_SETPIPE_SZ).
+
+#define TOTAL (4*1024*1024)
+#define CHUNK 8192
+#define BIGPIPE (64*1024)
+
+char buf[CHUNK];
+
+void failed()
+{
+  printf(1, "Test failed!\n");
+  exit();
+}
+
+void run(int size)
+{
+  int p[2], i, n, tot, pid, start;
+
+  if (pipe(p) < 0)
+    failed();
+  if (size > 0 && fcntl(p[1], F_SETPIPE_SZ, size) != size)
+    failed();
+  size = fcntl(p[0], F_GETPIPE_SZ, 0);
+
+  start = uptime();
+  if ((pid = fork()) < 0)
+    failed();
+  if (pid == 0) {
+    close(p[1]);
+    tot = 0;
+    while ((n = read(p[0], buf, sizeof(buf))) > 0) {
+      for (i = 0; i < n; i++)
+        if (buf[i] != (char)(tot + i)) {
+          printf(1, "Wrong byte at %d\n", tot + i);
+          exit();
+        }
+      tot += n;
+    }
+    if (tot != TOTAL)
+      printf(1, "Read %d bytes, expected %d\n", tot, TOTAL);
+    exit();
+  }
+  close(p[0]);
+  for (tot = 0; tot < TOTAL; tot += CHUNK) {
+    for (i = 0; i < CHUNK; i++)
+      buf[i] = (char)(tot + i);
+    if (write(p[1], buf, CHUNK) != CHUNK)
+      failed();
+  }
+  close(p[1]);
+  wait();
+  printf(1, "%d byte pipe: %d ticks\n", size, uptime() - start);
+}
+
+int main(int argc, char *argv[])
+{
+  int p[2];
+
+  printf(1, "Pipe benchmark: %d KB in %d byte writes\n", TOTAL / 1024, CHUNK);
+  run(0);
+  run(BIGPIPE);
+
+  // A pipe cannot shrink below what it holds.
+  if (pipe(p) < 0 || fcntl(p[1], F_SETPIPE_SZ, BIGPIPE) != BIGPIPE)
+    failed();
+  if (write(p[1], buf, CHUNK) != CHUNK ||
+      fcntl(p[1], F_SETPIPE_SZ, CHUNK / 2) != -1 ||
+      fcntl(p[1], F_SETPIPE_SZ, CHUNK) != CHUNK ||
+      read(p[0], buf, sizeof(buf)) != CHUNK)
+    failed();
+  printf(1, "All tests passed!\n");
+  exit();
+}
@@ -0,0 +1,12 @@
+// One descriptor of a poll call.
+struct pollfd {
+  int fd;         // Descriptor, or negative to skip the entry
+  short events;   // Conditions asked about
+  short revents;  // Conditions found, filled in by poll
+};
+
+#define POLLIN   0x01  // Reading would not block
+#define POLLOUT  0x04  // Writing would not block
+#define POLLERR  0x08  // Pipe has no reader (always reported)
+#define POLLHUP  0x10  // Pipe has no writer (always reported)
+#define POLLNVAL 0x20  // fd is not open (always reported)
@@ -0,0 +1,103 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "poll.h"
+
+// poll test: one process multiplexes two pipes, each fed by a
+// child writing at its own pace, then checks timeouts and
+// descriptors that are not open.
+
+#define NUM_MSG 10
+
+void failed()
+{
+  printf(1, "Test failed!\n");
+  exit();
+}
+
+void writer(int fd, int id, int delay)
+{
+  int i;
+  char c;
+
+  for (i = 0; i < NUM_MSG; i++) {
+    sleep(delay);
+    c = 'a' + id;
+    if (write(fd, &c, 1) != 1)
+      failed();
+  }
+  exit();
+}
+
+int main(int argc, char *argv[])
+{
+  struct pollfd fds[2];
+  int p[2][2], got[2], open, i, n, start;
+  char c;
+
+  printf(1, "poll test\n");
+  for (i = 0; i < 2; i++) {
+    if (pipe(p[i]) < 0)
+      failed();
+    n = fork();
+    if (n < 0)
+      failed();
+    if (n == 0) {
+      close(p[i][0]);
+      writer(p[i][1], i, i + 1);
+    }
+    close(p[i][1]);
+    fds[i].fd = p[i][0];
+    fds[i].events = POLLIN;
+    got[i] = 0;
+  }
+
+  for (open = 2; open > 0; ) {
+    if ((n = poll(fds, 2, -1)) <= 0)
+      failed();
+    for (i = 0; i < 2; i++) {
+      if (fds[i].revents & POLLIN) {
+        if ((n = read(fds[i].fd, &c, 1)) < 0)
+          failed();
+        if (n == 0) {
+          close(fds[i].fd);
+          fds[i].fd = -1;
+          open--;
+        } else if (c != 'a' + i) {
+          failed();
+        } else {
+          got[i]++;
+        }
+      }
+    }
+  }
+  wait();
+  wait();
+  if (got[0] != NUM_MSG || got[1] != NUM_MSG) {
+    printf(1, "Got %d and %d messages\n", got[0], got[1]);
+    failed();
+  }
+  printf(1, "two pipes: ok\n");
+
+  // Nothing to read: time out.
+  if (pipe(p[0]) < 0)
+    failed();
+  fds[0].fd = p[0][0];
+  fds[0].events = POLLIN;
+  fds[1].fd = p[0][1];
+  fds[1].events = 0;
+  start = uptime();
+  if (poll(fds, 2, 5) != 0 || uptime() - start < 5)
+    failed();
+  // But the write end has room.
+  fds[1].events = POLLOUT;
+  if (poll(fds, 2, 0) != 1 || fds[1].revents != POLLOUT)
+    failed();
+  close(p[0][0]);
+  close(p[0][1]);
+  if (poll(fds, 1, 0) != 1 || fds[0].revents != POLLNVAL)
+    failed();
+  printf(1, "timeouts: ok\n");
+  printf(1, "All tests passed!\n");
+  exit();
+}
@@ -6,6 +6,7 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "mm.h"
 
 struct {
   struct spinlock lock;
@@ -17,8 +18,10 @@ static struct proc *initproc;
 int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
+static void kthreadret(void);
 
 static void wakeup1(void *chan);
+static struct proc *tidlookup(thread_t tid);
 
 void
 pinit(void)
@@ -88,6 +91,7 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->affinity = ~0;
 
   release(&ptable.lock);
 
@@ -121,15 +125,15 @@ void
 userinit(void)
 {
   struct proc *p;
+  pde_t *pgdir;
   extern char _binary_initcode_start[], _binary_initcode_size[];
 
   p = allocproc();
 
   initproc = p;
-  if((p->pgdir = setupkvm()) == 0)
+  if((pgdir = setupkvm()) == 0 || (p->mm = mmalloc(pgdir, PGSIZE)) == 0)
     panic("userinit: out of memory?");
-  inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
-  p->sz = PGSIZE;
+  inituvm(pgdir, _binary_initcode_start, (int)_binary_initcode_size);
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
   p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
@@ -153,37 +157,51 @@ userinit(void)
   release(&ptable.lock);
 }
 
-// Grow current process's memory by n bytes.
-// Return 0 on success, -1 on failure.
+// Start a kernel process running fn(), which must never return.
+// It has no user memory; its page table maps only the kernel.
+// Returns the new pid, or -1 on failure.
 int
-growproc(int n)
+kthread(char *name, void (*fn)(void))
 {
-  uint sz;
-  struct proc *curproc = myproc();
   struct proc *p;
+  pde_t *pgdir;
 
-  acquire(&ptable.lock);
-
-  sz = curproc -> sz;
-
-  if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
-      return -1;
-  } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
-      return -1;
+  if((p = allocproc()) == 0)
+    return -1;
+  if((pgdir = setupkvm()) == 0 || (p->mm = mmalloc(pgdir, 0)) == 0){
+    if(pgdir)
+      freevm(pgdir);
+    kfree(p->kstack);
+    p->kstack = 0;
+    p->state = UNUSED;
+    return -1;
   }
-  curproc -> sz = sz;
 
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-    if (p -> pgdir == curproc -> pgdir) {
-      p -> sz = curproc -> sz;
-    }
-  }
+  // Start at kthreadret, which "returns" to fn
+  // in the slot allocproc left for trapret.
+  *(uint*)(p->context + 1) = (uint)fn;
+  p->context->eip = (uint)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
 
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
   release(&ptable.lock);
+  return p->pid;
+}
+
+// Grow current process's memory by n bytes.
+// The size lives in the mm shared by all threads of the process.
+// Return the old size on success, -1 on failure.
+int
+growproc(int n)
+{
+  int oldsz;
+  struct proc *curproc = myproc();
+
+  if((oldsz = mmgrow(curproc->mm, n)) < 0)
+    return -1;
   switchuvm(curproc);
-  return 0;
+  return oldsz;
 }
 
 // Create a new process copying p as the parent.
@@ -193,6 +211,8 @@ int
 fork(void)
 {
   int i, pid;
+  uint sz;
+  pde_t *pgdir;
   struct proc *np;
   struct proc *curproc = myproc();
 
@@ -202,13 +222,21 @@ fork(void)
   }
 
   // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+  acquire(&curproc->mm->lock);
+  sz = curproc->mm->sz;
+  pgdir = copyuvm(curproc->mm->pgdir, sz);
+  release(&curproc->mm->lock);
+  if(pgdir == 0 || (np->mm = mmalloc(pgdir, sz)) == 0){
+    if(pgdir)
+      freevm(pgdir);
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
     return -1;
   }
-  np->sz = curproc->sz;
+  mmcopystacks(np->mm, curproc->mm, curproc->ustack);
+  np->ustack = curproc->ustack;
+  np->affinity = curproc->affinity;
   np->parent = curproc;
   *np->tf = *curproc->tf;
 
@@ -263,19 +291,10 @@ exit(void)
 
   for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
     if (p != curproc && p -> pid == curproc -> pid) {
-        kfree(p->kstack);
-        p -> kstack = 0;
-        p -> state = UNUSED;
-        p -> sz = 0;
-        p -> pid = 0;
-        p -> parent = 0;
-        p -> name[0] = 0;
-        p -> killed = 0;
-        p -> is_thread = 0;
-        p -> tid = 0;
-        p -> retval = 0;
+      thread_free(p);
     }
   }
+  thread_promote(curproc);
 
   // Parent might be sleeping in wait().
   wakeup1(curproc->parent);
@@ -309,7 +328,8 @@ wait(void)
     // Scan through table looking for exited children.
     havekids = 0;
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
+      // Threads are reaped by thread_join(), never by wait().
+      if(p->parent != curproc || p->is_thread)
         continue;
       havekids = 1;
       if(p->state == ZOMBIE){
@@ -317,7 +337,9 @@ wait(void)
         pid = p->pid;
         kfree(p->kstack);
         p->kstack = 0;
-        freevm(p->pgdir);
+        mmput(p->mm);
+        p->mm = 0;
+        p->ustack = 0;
         p->pid = 0;
         p->parent = 0;
         p->name[0] = 0;
@@ -340,6 +362,73 @@ wait(void)
 }
 
 //PAGEBREAK: 42
+// Switch to chosen process.  It is the process's job
+// to release ptable.lock and then reacquire it
+// before jumping back to us.
+static void
+runproc(struct cpu *c, struct proc *p)
+{
+  c->proc = p;
+  switchuvm(p);
+  p->state = RUNNING;
+
+  swtch(&(c->scheduler), p->context);
+  switchkvm();
+
+  // Process is done running for now.
+  // It should have changed its p->state before coming back.
+  c->proc = 0;
+}
+
+// May p run on CPU c under its affinity mask?
+static int
+runshere(struct cpu *c, struct proc *p)
+{
+  return (p->affinity & (1 << (c - cpus))) != 0;
+}
+
+// Pick a process to run ahead of the round-robin scan: the target
+// of a directed yield, or else a runnable thread whose siblings are
+// running on other CPUs right now, so that a thread group makes
+// progress together instead of spinning on a descheduled lock holder.
+// The search resumes after the slot it last looked at, so siblings
+// take turns, and looks at no more than NPROC slots per scheduler
+// pass, counted in *nscan.
+// Must hold ptable.lock.
+static struct proc*
+hintproc(struct cpu *c, int *nscan)
+{
+  struct mm *running[NCPU];
+  struct proc *p;
+  struct cpu *oc;
+  int i, n;
+
+  p = c->yieldto;
+  c->yieldto = 0;
+  if(p && p->state == RUNNABLE && runshere(c, p))
+    return p;
+
+  if(!GANGSCHED)
+    return 0;
+  n = 0;
+  for(oc = cpus; oc < cpus+ncpu; oc++)
+    if(oc != c && oc->proc && oc->proc->mm)
+      running[n++] = oc->proc->mm;
+  if(n == 0)
+    return 0;
+  while(*nscan < NPROC){
+    c->hintpos = (c->hintpos + 1) % NPROC;
+    (*nscan)++;
+    p = &ptable.proc[c->hintpos];
+    if(p->state != RUNNABLE || !runshere(c, p))
+      continue;
+    for(i = 0; i < n; i++)
+      if(p->mm == running[i])
+        return p;
+  }
+  return 0;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -350,9 +439,12 @@ wait(void)
 void
 scheduler(void)
 {
-  struct proc *p;
+  struct proc *p, *hp;
   struct cpu *c = mycpu();
+  int nscan;
   c->proc = 0;
+  c->yieldto = 0;
+  c->hintpos = 0;
 
   for(;;){
     // Enable interrupts on this processor.
@@ -360,23 +452,17 @@ scheduler(void)
 
     // Loop over process table looking for process to run.
     acquire(&ptable.lock);
+    nscan = 0;
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
+      if(p->state != RUNNABLE || !runshere(c, p))
         continue;
 
-      // Switch to chosen process.  It is the process's job
-      // to release ptable.lock and then reacquire it
-      // before jumping back to us.
-      c->proc = p;
-      switchuvm(p);
-      p->state = RUNNING;
-
-      swtch(&(c->scheduler), p->context);
-      switchkvm();
-
-      // Process is done running for now.
-      // It should have changed its p->state before coming back.
-      c->proc = 0;
+      // A hinted process runs first, but only once per step of
+      // the scan, so it delays p without starving it.
+      if((hp = hintproc(c, &nscan)) != 0 && hp != p)
+        runproc(c, hp);
+      if(p->state == RUNNABLE && runshere(c, p))
+        runproc(c, p);
     }
     release(&ptable.lock);
 
@@ -419,6 +505,40 @@ yield(void)
   release(&ptable.lock);
 }
 
+// Give up the CPU because the caller waits on thread tid of its own
+// process (0 names the leader), typically for a user lock it holds.
+// A runnable tid runs next on this CPU; if tid is already running
+// elsewhere, return at once so the caller can keep spinning.
+int
+yieldto(thread_t tid)
+{
+  struct proc *curproc = myproc();
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  if(tid){
+    p = tidlookup(tid);
+  } else {
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+      if(p->state != UNUSED && p->pid == curproc->pid && !p->is_thread)
+        break;
+    if(p == &ptable.proc[NPROC])
+      p = 0;
+  }
+  if(p == 0 || p == curproc || p->pid != curproc->pid){
+    release(&ptable.lock);
+    return -1;
+  }
+  if(p->state != RUNNING){
+    if(p->state == RUNNABLE)
+      mycpu()->yieldto = p;
+    curproc->state = RUNNABLE;
+    sched();
+  }
+  release(&ptable.lock);
+  return 0;
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch here.  "Return" to user space.
 void
@@ -435,11 +555,21 @@ forkret(void)
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    bmapinit(ROOTDEV);
   }
 
   // Return to "caller", actually trapret (see allocproc).
 }
 
+// A kernel process's very first scheduling by scheduler()
+// will swtch here. "Return" to its body (see kthread).
+static void
+kthreadret(void)
+{
+  // Still holding ptable.lock from scheduler.
+  release(&ptable.lock);
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
@@ -524,6 +654,79 @@ kill(int pid)
   return -1;
 }
 
+// Find the proc named by id for setaffinity/getaffinity:
+// the caller if id is 0, else a thread by tid, else a process
+// leader by pid. tids and pids share one number space.
+// Caller must hold ptable.lock.
+static struct proc*
+affinityproc(int id)
+{
+  struct proc *p;
+
+  if(id == 0)
+    return myproc();
+  if((p = tidlookup(id)) != 0)
+    return p;
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p->state != UNUSED && p->pid == id && !p->is_thread)
+      return p;
+  return 0;
+}
+
+// Restrict the CPUs a thread or process may run on. For a
+// pid the mask applies to every thread of that process; for
+// a tid only to that thread. New threads and forked children
+// inherit the mask of their creator.
+int
+setaffinity(int id, uint mask)
+{
+  struct proc *p, *target;
+  int banned;
+
+  mask &= (1 << ncpu) - 1;
+  if(mask == 0)
+    return -1;
+
+  acquire(&ptable.lock);
+  if((target = affinityproc(id)) == 0){
+    release(&ptable.lock);
+    return -1;
+  }
+  if(target->is_thread){
+    target->affinity = mask;
+  } else {
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+      if(p->state != UNUSED && p->pid == target->pid)
+        p->affinity = mask;
+  }
+  release(&ptable.lock);
+
+  // Move off this CPU right away if it is no longer allowed.
+  pushcli();
+  banned = (myproc()->affinity & (1 << cpuid())) == 0;
+  popcli();
+  if(banned)
+    yield();
+  return 0;
+}
+
+// Return the affinity mask of a thread or process, or -1.
+int
+getaffinity(int id)
+{
+  struct proc *p;
+  int mask;
+
+  acquire(&ptable.lock);
+  if((p = affinityproc(id)) == 0){
+    release(&ptable.lock);
+    return -1;
+  }
+  mask = p->affinity & ((1 << ncpu) - 1);
+  release(&ptable.lock);
+  return mask;
+}
+
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
@@ -561,7 +764,91 @@ procdump(void)
   }
 }
 
-int nexttid = 1;
+// Threads are hashed by tid so that thread_join() can find its
+// target without scanning ptable. Protected by ptable.lock.
+#define NTIDHASH 16
+static struct proc *tidhash[NTIDHASH];
+
+static void
+tidhash_insert(struct proc *p)
+{
+  struct proc **bucket = &tidhash[p -> tid % NTIDHASH];
+
+  p -> tidnext = *bucket;
+  *bucket = p;
+}
+
+static void
+tidhash_remove(struct proc *p)
+{
+  struct proc **pp;
+
+  for (pp = &tidhash[p -> tid % NTIDHASH]; *pp; pp = &(*pp) -> tidnext) {
+    if (*pp == p) {
+      *pp = p -> tidnext;
+      break;
+    }
+  }
+  p -> tidnext = 0;
+}
+
+static struct proc*
+tidlookup(thread_t tid)
+{
+  struct proc *p;
+
+  for (p = tidhash[tid % NTIDHASH]; p; p = p -> tidnext) {
+    if (p -> tid == tid) {
+      return p;
+    }
+  }
+  return 0;
+}
+
+// Turn thread p into the leader of its process once its siblings
+// are gone, so that the parent's wait() reaps it like a process.
+// Caller must hold ptable.lock.
+void
+thread_promote(struct proc *p)
+{
+  if (p -> is_thread) {
+    tidhash_remove(p);
+    p -> is_thread = 0;
+    p -> tid = 0;
+    p -> thread_parent = 0;
+  }
+}
+
+// Release a thread's slot back to ptable.
+// Caller must hold ptable.lock.
+void
+thread_free(struct proc *p)
+{
+  if (p -> is_thread) {
+    tidhash_remove(p);
+  }
+  if (p -> kstack) {
+    kfree(p -> kstack);
+  }
+  if (p -> mm) {
+    if (p -> is_thread) {
+      mmstackfree(p -> mm, p -> ustack);
+    }
+    mmput(p -> mm);
+  }
+  p -> kstack = 0;
+  p -> mm = 0;
+  p -> ustack = 0;
+  p -> state = UNUSED;
+  p -> pid = 0;
+  p -> parent = 0;
+  p -> name[0] = 0;
+  p -> killed = 0;
+  p -> is_thread = 0;
+  p -> tid = 0;
+  p -> retval = 0;
+  p -> thread_parent = 0;
+}
 
 int thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg) {
 
@@ -570,52 +857,39 @@ int thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg) {
   uint sp, ustack[2];
 
   if ((np = allocproc()) == 0) {
-    np -> state = UNUSED;
-    release(&ptable.lock);
     return -1;
   }
 
-  acquire(&ptable.lock);
-
-  if ((np -> kstack = kalloc()) == 0) {
+  // The new thread shares curproc's mm; only its stack is its own.
+  if ((np -> ustack = mmstackalloc(curproc -> mm)) == 0) {
+    kfree(np -> kstack);
+    np -> kstack = 0;
     np -> state = UNUSED;
-    release(&ptable.lock);
-    return -1;
-  }
-  np -> pgdir = curproc -> pgdir;
-
-  np -> tid = nexttid++;
-  np -> is_thread = 1;
-  np -> pid = curproc -> pid;
-  np -> thread_parent = curproc; // 새로 생성된 스레드의 부모 프로세스를 설정합니다.
-  np -> state = EMBRYO;
-  np -> parent = curproc -> parent;
-  *np -> tf = *curproc -> tf;
-
-  uint sz = PGROUNDUP(curproc -> sz);
-  if((sz = allocuvm(np -> pgdir, sz, sz + 2*PGSIZE)) == 0) {
-    np -> state = UNUSED;
-    release(&ptable.lock);
     return -1;
   }
-  clearpteu(np -> pgdir, (char*)(curproc -> sz - 2 * PGSIZE));
-  np -> sz = sz;
+  np -> mm = mmdup(curproc -> mm);
 
-  for (struct proc *p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-    if (p -> pgdir == np -> pgdir) {
-      p -> sz = np -> sz;
-    }
-  }
-
-  sp = np -> sz;
+  sp = np -> ustack + 2*PGSIZE;
   ustack[0] = 0xffffffff;
   ustack[1] = (uint)arg;
   sp -= 8;
-  if (copyout(np->pgdir, sp, ustack, 8) < 0) {
-    np -> state = UNUSED;
+  if (copyout(np -> mm -> pgdir, sp, ustack, 8) < 0) {
+    mmstackfree(np -> mm, np -> ustack);
+    acquire(&ptable.lock);
+    thread_free(np);
     release(&ptable.lock);
     return -1;
   }
+
+  acquire(&ptable.lock);
+
+  np -> tid = np -> pid; // tid는 pid와 같은 번호 공간을 씁니다.
+  np -> is_thread = 1;
+  np -> pid = curproc -> pid;
+  np -> thread_parent = curproc; // 새로 생성된 스레드의 부모 프로세스를 설정합니다.
+  np -> parent = curproc -> parent;
+  np -> affinity = curproc -> affinity;
+  *np -> tf = *curproc -> tf;
   np -> tf -> eip = (uint)start_routine;
   np -> tf -> esp = sp;
 
@@ -632,6 +906,7 @@ int thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg) {
 
   acquire(&ptable.lock);
   np -> state = RUNNABLE;
+  tidhash_insert(np);
   *thread = np -> tid;
   release(&ptable.lock);
 
@@ -660,7 +935,9 @@ void thread_exit(void *retval) {
 
   acquire(&ptable.lock);
 
-  wakeup1(curproc -> thread_parent); // 부모 스레드를 깨웁니다.
+  // Joiners sleep on the exiting thread itself, so any thread of the
+  // process can join it, not only the one that created it.
+  wakeup1(curproc);
   curproc -> retval = retval;
   curproc -> state = ZOMBIE;
 
@@ -676,38 +953,26 @@ int thread_join(thread_t thread, void **retval) {
   acquire(&ptable.lock);
 
   for (;;) {
-    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-      if (p -> tid != thread) {
-        continue;
-      }
-      if (p -> state == ZOMBIE) {
-        *retval = p -> retval;
-        p -> retval = 0;
-
-        kfree(p -> kstack);
-        p -> kstack = 0;
-        p -> pid = 0;
-        p -> parent = 0;
-        p -> sz = 0;
-        p -> name[0] = 0;
-        p -> killed = 0;
-        p -> state = UNUSED;
-
-        p -> tid = 0;
-        p -> is_thread = 0;
-
-        release(&ptable.lock);
+    // Look the target up again after every wakeup: another joiner
+    // may have reaped it while we slept.
+    p = tidlookup(thread);
+    if (p == 0 || p == curproc || p -> pid != curproc -> pid) {
+      release(&ptable.lock);
+      return -1;
+    }
 
-        return 0;
-      }
+    if (p -> state == ZOMBIE) {
+      *retval = p -> retval;
+      thread_free(p);
+      release(&ptable.lock);
+      return 0;
     }
 
     if (curproc -> killed) {
-      p -> state = UNUSED;
       release(&ptable.lock);
       return -1;
     }
 
-    sleep(curproc, &ptable.lock);
+    sleep(p, &ptable.lock);
   }
 }
@@ -8,6 +8,8 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  struct proc *yieldto;        // Run this one next if runnable (yieldto)
+  int hintpos;                 // ptable slot hintproc looked at last
 };
 
 extern struct cpu cpus[NCPU];
@@ -36,8 +38,7 @@ enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
 struct proc {
-  uint sz;                     // Size of process memory (bytes)
-  pde_t* pgdir;                // Page table
+  struct mm *mm;               // Address space, shared by threads
   char *kstack;                // Bottom of kernel stack for this process
   enum procstate state;        // Process state
   int pid;                     // Process ID
@@ -48,12 +49,17 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  int logreserve;              // Log blocks its current FS op reserved
+  int logblocks;               // Log blocks added by its current FS op
   char name[16];               // Process name (debugging)
   // Thread
   int is_thread;
   int tid;
   void *retval;
   struct proc *thread_parent;
+  struct proc *tidnext;        // Next thread in the same tid hash bucket
+  uint ustack;                 // Base of this thread's user stack
+  uint affinity;               // Mask of CPUs it may run on
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -0,0 +1,97 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+// sendfile test: copy a file into a pipe read by a child, and
+// into a second file, checking the bytes that come out.
+
+#define FILESZ (40*1024 + 123)
+
+char buf[1024];
+
+void failed()
+{
+  printf(1, "Test failed!\n");
+  unlink("send.tmp");
+  unlink("send2.tmp");
+  exit();
+}
+
+int check(int fd)
+{
+  int i, n, off;
+
+  off = 0;
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    for (i = 0; i < n; i++, off++)
+      if (buf[i] != (char)(off % 251))
+        return -1;
+  }
+  return n < 0 ? -1 : off;
+}
+
+int main(int argc, char *argv[])
+{
+  int fd, fd2, p[2], i, n, off, pid, start;
+
+  printf(1, "sendfile test: %d bytes\n", FILESZ);
+  if ((fd = open("send.tmp", O_CREATE | O_RDWR)) < 0)
+    failed();
+  for (off = 0; off < FILESZ; off += n) {
+    n = FILESZ - off < sizeof(buf) ? FILESZ - off : sizeof(buf);
+    for (i = 0; i < n; i++)
+      buf[i] = (off + i) % 251;
+    if (write(fd, buf, n) != n)
+      failed();
+  }
+  close(fd);
+
+  // File to pipe, at the file's own offset.
+  if (pipe(p) < 0)
+    failed();
+  if ((pid = fork()) < 0)
+    failed();
+  if (pid == 0) {
+    close(p[1]);
+    if (check(p[0]) != FILESZ) {
+      printf(1, "Pipe got the wrong bytes\n");
+      exit();
+    }
+    printf(1, "file to pipe: ok\n");
+    exit();
+  }
+  close(p[0]);
+  if ((fd = open("send.tmp", O_RDONLY)) < 0)
+    failed();
+  start = uptime();
+  if (sendfile(p[1], fd, -1, FILESZ + 100) != FILESZ)
+    failed();
+  if (sendfile(p[1], fd, -1, 100) != 0)
+    failed();
+  close(p[1]);
+  wait();
+  printf(1, "%d ticks\n", uptime() - start);
+
+  // File to file, at an explicit offset.
+  if ((fd2 = open("send2.tmp", O_CREATE | O_RDWR)) < 0)
+    failed();
+  if (sendfile(fd2, fd, 0, FILESZ) != FILESZ)
+    failed();
+  close(fd2);
+  close(fd);
+  if ((fd2 = open("send2.tmp", O_RDONLY)) < 0 || check(fd2) != FILESZ) {
+    printf(1, "File copy has the wrong bytes\n");
+    failed();
+  }
+  close(fd2);
+  printf(1, "file to file: ok\n");
+
+  // Pipes are not a source.
+  if (pipe(p) < 0 || sendfile(1, p[0], -1, 1) != -1)
+    failed();
+  unlink("send.tmp");
+  unlink("send2.tmp");
+  printf(1, "All tests passed!\n");
+  exit();
+}
@@ -16,7 +16,7 @@
 int
 main(int argc, char *argv[])
 {
-  int fd, i;
+  int fd, i, start;
   char path[] = "stressfs0";
   char data[512];
 
@@ -28,14 +28,18 @@ main(int argc, char *argv[])
       break;
 
   printf(1, "write %d\n", i);
+  start = uptime();
 
   path[8] += i;
   fd = open(path, O_CREATE | O_RDWR);
   for(i = 0; i < 20; i++)
 //    printf(fd, "%d\n", i);
     write(fd, data, sizeof(data));
+  fsync(fd);
   close(fd);
 
+  printf(1, "write+fsync %d ticks\n", uptime() - start);
+
   printf(1, "read\n");
 
   fd = open(path, O_RDONLY);
@@ -23,3 +23,16 @@
 #define SYS_thread_create 22
 #define SYS_thread_exit 23
 #define SYS_thread_join 24
+#define SYS_yieldto 25
+#define SYS_setaffinity 26
+#define SYS_getaffinity 27
+#define SYS_bstat  28
+#define SYS_fsync  29
+#define SYS_dstat  30
+#define SYS_pread  31
+#define SYS_pwrite 32
+#define SYS_readv  33
+#define SYS_writev 34
+#define SYS_sendfile 35
+#define SYS_fcntl  36
+#define SYS_poll   37
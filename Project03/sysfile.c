@@ -12,9 +12,14 @@
 #include "proc.h"
 #include "fs.h"
 #include "spinlock.h"
+#include "mm.h"
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "bstat.h"
+#include "dstat.h"
+#include "uio.h"
+#include "poll.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -90,6 +95,168 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// Read or write at an explicit offset, leaving the file's
+// own offset alone, so threads sharing a descriptor need
+// not seek around each other.
+int
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int off;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &iov.len) < 0 ||
+     argptr(1, (void*)&iov.base, iov.len) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filereadv(f, &iov, 1, off);
+}
+
+int
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int off;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &iov.len) < 0 ||
+     argptr(1, (void*)&iov.base, iov.len) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filewritev(f, &iov, 1, off);
+}
+
+// Fetch the nth system call argument as a vector of cnt
+// iovecs, copying it into iov and checking that each
+// buffer lies within the process address space.
+static int
+argiov(int n, int cnt, struct iovec *iov)
+{
+  struct iovec *uiov;
+  uint sz, tot;
+  int i;
+
+  if(cnt < 0 || cnt > NIOV)
+    return -1;
+  if(argptr(n, (void*)&uiov, cnt*sizeof(*uiov)) < 0)
+    return -1;
+  sz = myproc()->mm->sz;
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    iov[i] = uiov[i];
+    if(iov[i].len < 0 || (uint)iov[i].base >= sz ||
+       (uint)iov[i].base + iov[i].len > sz)
+      return -1;
+    if((tot += iov[i].len) > 0x7fffffff)
+      return -1;
+  }
+  return 0;
+}
+
+int
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[NIOV];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &cnt) < 0 || argiov(1, cnt, iov) < 0)
+    return -1;
+  return filereadv(f, iov, cnt, -1);
+}
+
+int
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[NIOV];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &cnt) < 0 || argiov(1, cnt, iov) < 0)
+    return -1;
+  return filewritev(f, iov, cnt, -1);
+}
+
+// Copy n bytes from file in_fd, at offset off or at its own
+// offset if off is -1, to out_fd, inside the kernel.
+int
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int off, n;
+
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 ||
+     argint(2, &off) < 0 || argint(3, &n) < 0 || off < -1 || n < 0)
+    return -1;
+  return filesend(out, in, off, n);
+}
+
+// Get or set properties of an open file. Only pipe buffer
+// sizes, for now.
+int
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  if(f->type != FD_PIPE)
+    return -1;
+  switch(cmd){
+  case F_GETPIPE_SZ:
+    return pipegetsize(f->pipe);
+  case F_SETPIPE_SZ:
+    return pipesetsize(f->pipe, arg);
+  }
+  return -1;
+}
+
+// Wait until one of n descriptors is ready for what its entry
+// asks, or for timeout ticks; forever if timeout is negative.
+// Fill in each entry's revents and return how many are nonzero.
+int
+sys_poll(void)
+{
+  struct pollfd *fds;
+  struct file *f;
+  int i, n, timeout, timed, nready;
+  uint seq, ticks0;
+
+  if(argint(1, &n) < 0 || n < 0 || n > NOFILE ||
+     argptr(0, (void*)&fds, n*sizeof(*fds)) < 0 || argint(2, &timeout) < 0)
+    return -1;
+
+  acquire(&tickslock);
+  ticks0 = ticks;
+  release(&tickslock);
+  timed = timeout > 0;
+  seq = pollbegin(timed);
+  for(;;){
+    nready = 0;
+    for(i = 0; i < n; i++){
+      fds[i].revents = 0;
+      if(fds[i].fd < 0)
+        continue;
+      if(fds[i].fd >= NOFILE || (f = myproc()->ofile[fds[i].fd]) == 0)
+        fds[i].revents = POLLNVAL;
+      else
+        fds[i].revents = filepoll(f, fds[i].events);
+      if(fds[i].revents)
+        nready++;
+    }
+    if(nready > 0 || timeout == 0 || (timed && ticks - ticks0 >= timeout))
+      break;
+    if(myproc()->killed){
+      nready = -1;
+      break;
+    }
+    seq = pollsleep(seq);
+  }
+  pollend(timed);
+  return nready;
+}
+
 int
 sys_close(void)
 {
@@ -124,7 +291,7 @@ sys_link(void)
   if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
     return -1;
 
-  begin_op();
+  begin_opn(DIROPBLOCKS);
   if((ip = namei(old)) == 0){
     end_op();
     return -1;
@@ -171,10 +338,13 @@ isdirempty(struct inode *dp)
   int off;
   struct dirent de;
 
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
+  // A hashed directory keeps . and .. in its buckets,
+  // so look at every entry.
+  for(off=0; off<dp->size; off+=sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
       panic("isdirempty: readi");
-    if(de.inum != 0)
+    if(de.inum != 0 && namecmp(de.name, ".") != 0 &&
+       namecmp(de.name, "..") != 0)
       return 0;
   }
   return 1;
@@ -218,6 +388,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcforget(dp, name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -266,6 +437,16 @@ create(char *path, short type, short major, short minor)
   ip->nlink = 1;
   iupdate(ip);
 
+  // A full hashed directory can refuse the name;
+  // free the new inode again.
+  if(dirlink(dp, name, ip->inum) < 0){
+    ip->nlink = 0;
+    iupdate(ip);
+    iunlockput(ip);
+    iunlockput(dp);
+    return 0;
+  }
+
   if(type == T_DIR){  // Create . and .. entries.
     dp->nlink++;  // for ".."
     iupdate(dp);
@@ -274,9 +455,6 @@ create(char *path, short type, short major, short minor)
       panic("create dots");
   }
 
-  if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
-
   iunlockput(dp);
 
   return ip;
@@ -293,7 +471,7 @@ sys_open(void)
   if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
     return -1;
 
-  begin_op();
+  begin_opn(omode & O_CREATE ? DIROPBLOCKS : MAXOPBLOCKS);
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
@@ -338,7 +516,7 @@ sys_mkdir(void)
   char *path;
   struct inode *ip;
 
-  begin_op();
+  begin_opn(DIROPBLOCKS);
   if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
@@ -355,7 +533,7 @@ sys_mknod(void)
   char *path;
   int major, minor;
 
-  begin_op();
+  begin_opn(DIROPBLOCKS);
   if((argstr(0, &path)) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
@@ -442,3 +620,39 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+int
+sys_bstat(void)
+{
+  struct bstat *st;
+
+  if(argptr(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  bcachestat(st);
+  return 0;
+}
+
+int
+sys_dstat(void)
+{
+  struct dstat *st;
+
+  if(argptr(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  idestats(st);
+  return 0;
+}
+
+// Wait until earlier writes to the file are on disk.
+// The log commits all pending calls together, so this
+// flushes every file, not just fd.
+int
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  log_sync();
+  return 0;
+}
@@ -50,8 +50,7 @@ sys_sbrk(void)
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
+  if((addr = growproc(n)) < 0)
     return -1;
   return addr;
 }
@@ -125,3 +124,33 @@ int sys_thread_join(void) {
 
   return thread_join(thread, retval);
 }
+
+int sys_yieldto(void) {
+  thread_t thread;
+
+  if (argint(0, (int *)&thread) < 0) {
+    return -1;
+  }
+
+  return yieldto(thread);
+}
+
+int sys_setaffinity(void) {
+  int id, mask;
+
+  if (argint(0, &id) < 0 || argint(1, &mask) < 0) {
+    return -1;
+  }
+
+  return setaffinity(id, (uint)mask);
+}
+
+int sys_getaffinity(void) {
+  int id;
+
+  if (argint(0, &id) < 0) {
+    return -1;
+  }
+
+  return getaffinity(id);
+}
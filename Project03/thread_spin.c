@@ -0,0 +1,108 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+
+// Lock contention benchmark for thread groups.
+// NUM_THREAD threads take turns on a user-level spinlock whose
+// critical section is long enough to be preempted by the timer.
+// Waiters either spin blindly or hand their CPU to the holder with
+// yieldto(). Rebuild the kernel with GANGSCHED set to 0 in param.h
+// to compare against a scheduler without co-scheduling.
+
+#define NUM_THREAD 8
+#define NUM_ROUND 200
+#define CS_WORK 20000
+
+struct ulock {
+  volatile uint locked;
+  volatile thread_t owner;
+};
+
+struct ulock lk;
+thread_t thread[NUM_THREAD];
+uint spins[NUM_THREAD];
+int use_hint;
+volatile int counter;
+
+void failed()
+{
+  printf(1, "Test failed!\n");
+  exit();
+}
+
+void ulock_acquire(struct ulock *l, thread_t self, uint *nspin)
+{
+  while (xchg(&l->locked, 1) != 0) {
+    (*nspin)++;
+    if (use_hint && l->owner != 0 && (*nspin % 64) == 0)
+      yieldto(l->owner);
+  }
+  l->owner = self;
+}
+
+void ulock_release(struct ulock *l)
+{
+  l->owner = 0;
+  xchg(&l->locked, 0);
+}
+
+void *thread_main(void *arg)
+{
+  int val = (int)arg;
+  int i, j;
+
+  for (i = 0; i < NUM_ROUND; i++) {
+    ulock_acquire(&lk, thread[val], &spins[val]);
+    for (j = 0; j < CS_WORK; j++)
+      counter++;
+    ulock_release(&lk);
+  }
+  thread_exit(arg);
+  return 0;
+}
+
+void run(int hint)
+{
+  int i, retval, start, elapsed;
+  uint total;
+
+  use_hint = hint;
+  counter = 0;
+  for (i = 0; i < NUM_THREAD; i++)
+    spins[i] = 0;
+
+  start = uptime();
+  for (i = 0; i < NUM_THREAD; i++) {
+    if (thread_create(&thread[i], thread_main, (void *)i) != 0) {
+      printf(1, "Error creating thread %d\n", i);
+      failed();
+    }
+  }
+  for (i = 0; i < NUM_THREAD; i++) {
+    if (thread_join(thread[i], (void **)&retval) != 0 || retval != i) {
+      printf(1, "Error joining thread %d\n", i);
+      failed();
+    }
+  }
+  elapsed = uptime() - start;
+
+  if (counter != NUM_THREAD * NUM_ROUND * CS_WORK) {
+    printf(1, "Lost updates: counter %d\n", counter);
+    failed();
+  }
+  total = 0;
+  for (i = 0; i < NUM_THREAD; i++)
+    total += spins[i];
+  printf(1, "%s: %d ticks, %d spins\n",
+         hint ? "yieldto" : "spin   ", elapsed, total);
+}
+
+int main(int argc, char *argv[])
+{
+  printf(1, "Thread spin benchmark: %d threads, %d rounds\n",
+         NUM_THREAD, NUM_ROUND);
+  run(0);
+  run(1);
+  exit();
+}
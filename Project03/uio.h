@@ -0,0 +1,7 @@
+// One buffer of a readv or writev vector.
+struct iovec {
+  void *base;
+  int len;
+};
+
+#define NIOV 32  // most buffers in one vector
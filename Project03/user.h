@@ -1,5 +1,9 @@
 struct stat;
 struct rtcdate;
+struct bstat;
+struct dstat;
+struct iovec;
+struct pollfd;
 
 // system calls
 int fork(void);
@@ -23,6 +27,16 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int bstat(struct bstat*);
+int fsync(int);
+int dstat(struct dstat*);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int sendfile(int, int, int, int);
+int fcntl(int, int, int);
+int poll(struct pollfd*, int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -42,3 +56,12 @@ int atoi(const char*);
 int thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg);
 void thread_exit(void *retval);
 int thread_join(thread_t thread, void **retval);
+int yieldto(thread_t thread);
+int setaffinity(int id, uint mask);
+int getaffinity(int id);
+
+// uthread.c
+int gspawn(void (*fn)(void*), void *arg);
+void gyield(void);
+void gexit(void) __attribute__((noreturn));
+int grun(int nworker);
@@ -0,0 +1,239 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+
+// Green threads: cooperative user-level tasks multiplexed onto a
+// few kernel threads. A task costs one GSTACKSIZE page of user
+// memory and switches with uswtch, never entering the kernel, so
+// thousands of them fit where NPROC kernel threads would not.
+//
+// Each task's struct gthread sits at the bottom of its own
+// GSTACKSIZE-aligned stack, so the running task is found from %esp.
+
+#define GSTACKSIZE 4096
+#define GCHUNK     16    // stacks carved from one sbrk
+#define GWORKER    8     // max kernel threads running tasks
+
+// Saved registers, as laid out on the stack by uswtch.S.
+struct ucontext {
+  uint edi;
+  uint esi;
+  uint ebx;
+  uint ebp;
+  uint eip;
+};
+
+enum gstate { G_RUNNABLE, G_EXITED };
+
+struct gthread {
+  struct ucontext *context;   // uswtch() here to run the task
+  struct ucontext **sched;    // Scheduler context of its worker
+  struct gthread *next;       // Run queue or free list
+  enum gstate state;
+  void (*fn)(void*);
+  void *arg;
+};
+
+void uswtch(struct ucontext**, struct ucontext*);
+
+static struct {
+  volatile uint locked;
+  struct gthread *head;       // Run queue, FIFO
+  struct gthread *tail;
+  struct gthread *free;       // Stacks of exited tasks
+  int nlive;                  // Tasks spawned but not exited
+} gq;
+
+static void
+glock(void)
+{
+  while(xchg(&gq.locked, 1) != 0)
+    ;
+}
+
+static void
+gunlock(void)
+{
+  xchg(&gq.locked, 0);
+}
+
+// Return the running task. Only valid on a task's stack.
+static struct gthread*
+gself(void)
+{
+  uint esp;
+
+  asm volatile("movl %%esp, %0" : "=r" (esp));
+  return (struct gthread*)(esp & ~(GSTACKSIZE-1));
+}
+
+// Take a free task stack, refilling the free list from sbrk.
+// Must hold gq lock.
+static struct gthread*
+galloc(void)
+{
+  struct gthread *t;
+  uint p;
+  int i;
+
+  if(gq.free == 0){
+    if((p = (uint)sbrk((GCHUNK+1)*GSTACKSIZE)) == (uint)-1)
+      return 0;
+    p = (p + GSTACKSIZE-1) & ~(GSTACKSIZE-1);
+    for(i = 0; i < GCHUNK; i++){
+      t = (struct gthread*)(p + i*GSTACKSIZE);
+      t->next = gq.free;
+      gq.free = t;
+    }
+  }
+  t = gq.free;
+  gq.free = t->next;
+  return t;
+}
+
+// Append t to the run queue. Must hold gq lock.
+static void
+genqueue(struct gthread *t)
+{
+  t->next = 0;
+  if(gq.tail)
+    gq.tail->next = t;
+  else
+    gq.head = t;
+  gq.tail = t;
+}
+
+// First code a new task runs, entered from uswtch.
+static void
+gstart(void)
+{
+  struct gthread *t = gself();
+
+  t->fn(t->arg);
+  gexit();
+}
+
+// Create a task running fn(arg). It starts once a worker
+// started by grun() picks it up.
+// Return 0 on success, -1 if out of memory.
+int
+gspawn(void (*fn)(void*), void *arg)
+{
+  struct gthread *t;
+  struct ucontext *c;
+
+  glock();
+  if((t = galloc()) == 0){
+    gunlock();
+    return -1;
+  }
+  t->fn = fn;
+  t->arg = arg;
+  t->state = G_RUNNABLE;
+  t->sched = 0;
+
+  // Leave a fake return address above the context, as if
+  // gstart had been called.
+  c = (struct ucontext*)((char*)t + GSTACKSIZE - 4) - 1;
+  memset(c, 0, sizeof(*c) + 4);
+  c->eip = (uint)gstart;
+  t->context = c;
+
+  gq.nlive++;
+  genqueue(t);
+  gunlock();
+  return 0;
+}
+
+// Let other tasks run. The worker requeues us after the switch,
+// so no other worker can resume this task before it is saved.
+void
+gyield(void)
+{
+  struct gthread *t = gself();
+
+  uswtch(&t->context, *t->sched);
+}
+
+// Finish the running task. Its stack is recycled by the worker.
+void
+gexit(void)
+{
+  struct gthread *t = gself();
+
+  t->state = G_EXITED;
+  uswtch(&t->context, *t->sched);
+  printf(2, "gexit: resumed\n");
+  exit();
+}
+
+// Run tasks from the queue until none are left.
+static void
+gschedule(void)
+{
+  struct ucontext *sched;
+  struct gthread *t;
+
+  for(;;){
+    glock();
+    if((t = gq.head) != 0){
+      if((gq.head = t->next) == 0)
+        gq.tail = 0;
+    } else if(gq.nlive == 0){
+      gunlock();
+      return;
+    }
+    gunlock();
+    if(t == 0){
+      // Other workers still run tasks that may spawn more or
+      // requeue themselves; give up the CPU rather than spin.
+      sleep(1);
+      continue;
+    }
+
+    t->sched = &sched;
+    uswtch(&sched, t->context);
+
+    glock();
+    if(t->state == G_EXITED){
+      t->next = gq.free;
+      gq.free = t;
+      gq.nlive--;
+    } else {
+      genqueue(t);
+    }
+    gunlock();
+  }
+}
+
+static void*
+gworker(void *arg)
+{
+  gschedule();
+  thread_exit(arg);
+  return 0;
+}
+
+// Run all spawned tasks on up to nworker kernel threads, the
+// caller being one of them. Return the number of workers used
+// once every task has exited.
+int
+grun(int nworker)
+{
+  thread_t tids[GWORKER];
+  void *retval;
+  int i, n;
+
+  if(nworker > GWORKER)
+    nworker = GWORKER;
+  n = 0;
+  for(i = 1; i < nworker; i++)
+    if(thread_create(&tids[n], gworker, 0) == 0)
+      n++;
+
+  gschedule();
+  for(i = 0; i < n; i++)
+    thread_join(tids[i], &retval);
+  return n + 1;
+}
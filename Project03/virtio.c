@@ -0,0 +1,348 @@
+// Disk driver for a legacy virtio-blk PCI device, providing the same
+// interface as ide.c.  Build kernelvirtio and run with
+// make qemu-virtio to keep the file system on it.
+//
+// Each request is a chain of three descriptors: a header naming
+// the sector, the block's data, and a status byte the device fills
+// in.  Requests are published in the available ring and the device
+// is notified once per batch; it hands them back through the used
+// ring and raises one interrupt for however many it finished.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "dstat.h"
+
+// Legacy virtio PCI registers, from the I/O base in BAR0.
+#define VIRTIO_FEATURES   0x00  // device features
+#define VIRTIO_GFEATURES  0x04  // features the driver accepts
+#define VIRTIO_QPFN       0x08  // queue address / PGSIZE
+#define VIRTIO_QSIZE      0x0c
+#define VIRTIO_QSEL       0x0e
+#define VIRTIO_QNOTIFY    0x10
+#define VIRTIO_STATUS     0x12
+#define VIRTIO_ISR        0x13
+
+// Device status bits.
+#define VIRTIO_ACK        1
+#define VIRTIO_DRIVER     2
+#define VIRTIO_DRIVER_OK  4
+
+#define VRING_DESC_F_NEXT   1
+#define VRING_DESC_F_WRITE  2  // device writes, rather than reads
+#define VRING_USED_F_NO_NOTIFY 1
+
+#define VIRTIO_BLK_T_IN   0  // read
+#define VIRTIO_BLK_T_OUT  1  // write
+
+#define NDESC 256  // largest queue that fits in vqmem
+
+struct vdesc {
+  uint addr;
+  uint addrhi;
+  uint len;
+  ushort flags;
+  ushort next;
+};
+
+struct vavail {
+  ushort flags;
+  ushort idx;
+  ushort ring[];
+};
+
+struct vusedelem {
+  uint id;
+  uint len;
+};
+
+struct vused {
+  ushort flags;
+  ushort idx;
+  struct vusedelem ring[];
+};
+
+struct vblkhdr {
+  uint type;
+  uint reserved;
+  uint sector;
+  uint sectorhi;
+};
+
+// The vring, in physically contiguous pages: descriptors, then
+// the available ring, then the used ring on a page boundary.
+static char vqmem[3*PGSIZE] __attribute__((aligned(PGSIZE)));
+
+static struct {
+  struct spinlock lock;
+  ushort base;          // I/O base
+  int n;                // queue size
+  struct vdesc *desc;
+  struct vavail *avail;
+  volatile struct vused *used;
+  ushort usedidx;       // next used entry to look at
+  int nfree;
+  char free[NDESC];     // is a descriptor free?
+  struct vblkhdr hdr[NDESC];   // by first descriptor of a request
+  uchar status[NDESC];
+  struct buf *buf[NDESC];
+  int pending;          // published but not yet notified
+  struct dstat stat;
+} vq;
+
+void
+ideinit(void)
+{
+  uint tag;
+  int i, irq;
+
+  initlock(&vq.lock, "virtio");
+
+  if((tag = pcifind(0x00, 0x10011af4, 0xffffffff)) == 0)
+    panic("virtio: no disk");
+  vq.base = pciread(tag, 0x10) & 0xfffc;  // BAR0
+  irq = pciread(tag, 0x3c) & 0xff;
+  pcienable(tag);
+
+  outb(vq.base + VIRTIO_STATUS, 0);  // reset
+  outb(vq.base + VIRTIO_STATUS, VIRTIO_ACK);
+  outb(vq.base + VIRTIO_STATUS, VIRTIO_ACK | VIRTIO_DRIVER);
+  outl(vq.base + VIRTIO_GFEATURES, 0);
+
+  outw(vq.base + VIRTIO_QSEL, 0);
+  vq.n = inw(vq.base + VIRTIO_QSIZE);
+  if(vq.n == 0 || vq.n > NDESC)
+    panic("virtio: queue size");
+  memset(vqmem, 0, sizeof(vqmem));
+  vq.desc = (struct vdesc*)vqmem;
+  vq.avail = (struct vavail*)(vqmem + vq.n*sizeof(struct vdesc));
+  vq.used = (struct vused*)(vqmem +
+    PGROUNDUP(vq.n*sizeof(struct vdesc) + 6 + 2*vq.n));
+  outl(vq.base + VIRTIO_QPFN, V2P(vqmem) / PGSIZE);
+
+  for(i = 0; i < vq.n; i++)
+    vq.free[i] = 1;
+  vq.nfree = vq.n;
+
+  outb(vq.base + VIRTIO_STATUS,
+       VIRTIO_ACK | VIRTIO_DRIVER | VIRTIO_DRIVER_OK);
+
+  // trap() hands the disk vector to ideintr().
+  ioapicroute(irq, T_IRQ0 + IRQ_IDE, ncpu - 1);
+}
+
+static int
+vqalloc(void)
+{
+  int i;
+
+  for(i = 0; i < vq.n; i++){
+    if(vq.free[i]){
+      vq.free[i] = 0;
+      vq.nfree--;
+      return i;
+    }
+  }
+  panic("virtio: no descriptor");
+}
+
+static void
+vqfree(int i)
+{
+  vq.free[i] = 1;
+  vq.nfree++;
+}
+
+// Tell the device about published requests, unless it has
+// said it will look without being told.
+static void
+vqnotify(void)
+{
+  if(vq.pending == 0)
+    return;
+  vq.pending = 0;
+  vq.stat.ncmd++;
+  __sync_synchronize();
+  if((vq.used->flags & VRING_USED_F_NO_NOTIFY) == 0)
+    outw(vq.base + VIRTIO_QNOTIFY, 0);
+}
+
+// Publish a request for b, waiting for descriptors if the
+// queue is full. Caller must hold vq.lock.
+static void
+vqsubmit(struct buf *b)
+{
+  int d[3], i;
+
+  while(vq.nfree < 3){
+    vqnotify();
+    sleep(&vq.nfree, &vq.lock);
+  }
+  for(i = 0; i < 3; i++)
+    d[i] = vqalloc();
+
+  vq.hdr[d[0]].type = (b->flags & B_DIRTY) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  vq.hdr[d[0]].reserved = 0;
+  vq.hdr[d[0]].sector = b->blockno * (bsize/512);
+  vq.hdr[d[0]].sectorhi = 0;
+  vq.status[d[0]] = 0xff;
+  vq.buf[d[0]] = b;
+
+  vq.desc[d[0]].addr = V2P(&vq.hdr[d[0]]);
+  vq.desc[d[0]].addrhi = 0;
+  vq.desc[d[0]].len = sizeof(struct vblkhdr);
+  vq.desc[d[0]].flags = VRING_DESC_F_NEXT;
+  vq.desc[d[0]].next = d[1];
+
+  vq.desc[d[1]].addr = V2P(b->data);
+  vq.desc[d[1]].addrhi = 0;
+  vq.desc[d[1]].len = bsize;
+  vq.desc[d[1]].flags = VRING_DESC_F_NEXT;
+  if((b->flags & B_DIRTY) == 0)
+    vq.desc[d[1]].flags |= VRING_DESC_F_WRITE;
+  vq.desc[d[1]].next = d[2];
+
+  vq.desc[d[2]].addr = V2P(&vq.status[d[0]]);
+  vq.desc[d[2]].addrhi = 0;
+  vq.desc[d[2]].len = 1;
+  vq.desc[d[2]].flags = VRING_DESC_F_WRITE;
+  vq.desc[d[2]].next = 0;
+
+  b->qtime = ticks;
+  vq.stat.nreq++;
+  vq.stat.depth++;
+  vq.stat.sumdepth += vq.stat.depth;
+  if(vq.stat.depth > vq.stat.maxdepth)
+    vq.stat.maxdepth = vq.stat.depth;
+  if(b->flags & B_DIRTY)
+    vq.stat.nwrite++;
+  else
+    vq.stat.nread++;
+
+  vq.avail->ring[vq.avail->idx % vq.n] = d[0];
+  __sync_synchronize();
+  vq.avail->idx++;
+  vq.pending++;
+}
+
+// Interrupt handler.
+void
+ideintr(void)
+{
+  struct buf *b;
+  int d, i;
+
+  acquire(&vq.lock);
+
+  // Reading the ISR acknowledges the interrupt.
+  inb(vq.base + VIRTIO_ISR);
+
+  __sync_synchronize();
+  while(vq.usedidx != vq.used->idx){
+    d = vq.used->ring[vq.usedidx % vq.n].id;
+    vq.usedidx++;
+
+    b = vq.buf[d];
+    vq.buf[d] = 0;
+    if(vq.status[d] != 0)
+      panic("virtio: request failed");
+    vq.stat.depth--;
+    vq.stat.waitticks += ticks - b->qtime;
+
+    for(i = d; vq.desc[i].flags & VRING_DESC_F_NEXT; i = vq.desc[i].next)
+      vqfree(i);
+    vqfree(i);
+
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if(b->flags & B_ASYNC){
+      b->flags &= ~B_ASYNC;
+      basyncdone(b);
+    } else
+      wakeup(b);
+  }
+  wakeup(&vq.nfree);
+
+  release(&vq.lock);
+}
+
+//PAGEBREAK!
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("iderw: buf not locked");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("iderw: nothing to do");
+  if(b->dev != 1)
+    panic("iderw: request not for disk 1");
+
+  acquire(&vq.lock);
+  vqsubmit(b);
+  vqnotify();
+
+  // Wait for request to finish. ideintr releases
+  // asynchronous reads itself.
+  if((b->flags & B_ASYNC) == 0){
+    while((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+      sleep(b, &vq.lock);
+  }
+  release(&vq.lock);
+}
+
+// Sync n bufs with disk, as iderw does, notifying the device
+// once. Either all or none are asynchronous reads.
+void
+iderwv(struct buf **bp, int n)
+{
+  int i, async;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bp[i]->lock))
+      panic("iderwv: buf not locked");
+    if((bp[i]->flags & (B_VALID|B_DIRTY)) == B_VALID)
+      panic("iderwv: nothing to do");
+    if((bp[i]->flags & B_ASYNC) != (bp[0]->flags & B_ASYNC))
+      panic("iderwv: mixed async");
+    if(bp[i]->dev != 1)
+      panic("iderwv: request not for disk 1");
+  }
+  if(n == 0)
+    return;
+  async = bp[0]->flags & B_ASYNC;
+
+  acquire(&vq.lock);
+  for(i = 0; i < n; i++)
+    vqsubmit(bp[i]);
+  vqnotify();
+
+  if(!async){
+    for(i = 0; i < n; i++)
+      while((bp[i]->flags & (B_VALID|B_DIRTY)) != B_VALID)
+        sleep(bp[i], &vq.lock);
+  }
+  release(&vq.lock);
+}
+
+// Copy out the disk queue statistics.
+void
+idestats(struct dstat *st)
+{
+  acquire(&vq.lock);
+  *st = vq.stat;
+  st->bsize = bsize;
+  st->dma = 1;
+  release(&vq.lock);
+}